@@ -0,0 +1,590 @@
+// Micro benchmarks of the CPU side hot paths of the flyers demo.
+//
+// Every benchmark is run until --min-time seconds have passed and reported as
+// one CSV line on stdout:
+//   benchmark,items,iterations,ns_per_op,items_per_s,allocs_per_op,bytes_per_op
+// One op is one call of the benchmarked function, items is the amount of work
+// (vertices, triangles, segments, ...) one op processes. Diagnostics the
+// measured code prints (loadOBJ logs every file) are moved to stderr.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtx/quaternion.hpp>
+using namespace glm;
+
+#include <common/objloader.hpp>
+#include <common/tangentspace.hpp>
+#include <common/vboindexer.hpp>
+#include <common/quaternion_utils.hpp>
+#include <common/projection.hpp>
+#include <common/line_clipper.hpp>
+#include <common/frustum.hpp>
+#include <common/ground_grid.hpp>
+#include <common/bvh.hpp>
+#include <common/stdout_handle.hpp>
+#include <common/trajectories.hpp>
+#include <common/thread_pool.hpp>
+#include <common/tile_rasterizer.hpp>
+
+#include <submission/drawables.hpp>
+
+// Allocation counting: every global operator new goes through here
+
+namespace {
+
+std::atomic<size_t> alloc_count(0);
+std::atomic<size_t> alloc_bytes(0);
+
+void * counted_alloc(size_t size){
+	alloc_count.fetch_add(1, std::memory_order_relaxed);
+	alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+	void * p = malloc(size ? size : 1);
+	if (p == nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+
+}
+
+void * operator new(size_t size){ return counted_alloc(size); }
+void * operator new[](size_t size){ return counted_alloc(size); }
+void operator delete(void * p) noexcept { free(p); }
+void operator delete[](void * p) noexcept { free(p); }
+void operator delete(void * p, size_t) noexcept { free(p); }
+void operator delete[](void * p, size_t) noexcept { free(p); }
+
+namespace {
+
+struct BenchOptions
+{
+	double min_time = 0.5;  // seconds per benchmark
+	size_t size = 1024;     // items per op
+	const char * filter = nullptr;
+};
+
+FILE * results = stdout;
+
+// Keeps the optimiser from dropping the benchmarked calls
+volatile float sink = 0;
+
+void consume(float v){ sink = sink + v; }
+void consume(const glm::vec3 & v){ consume(v.x + v.y + v.z); }
+void consume(const glm::mat4 & m){ consume(m[0][0] + m[1][1] + m[2][2] + m[3][3]); }
+void consume(const glm::quat & q){ consume(q.x + q.y + q.z + q.w); }
+
+void run(const BenchOptions & opts, const char * name, size_t items, const std::function<void()> & op)
+{
+	if (opts.filter and strstr(name, opts.filter) == nullptr)
+		return;
+
+	typedef std::chrono::steady_clock clock;
+
+	// warm up caches and any lazily grown storage
+	op();
+
+	size_t iterations = 1;
+	double elapsed = 0;
+	size_t allocs = 0;
+	size_t bytes = 0;
+
+	for (;;){
+		const size_t allocs_before = alloc_count.load();
+		const size_t bytes_before = alloc_bytes.load();
+		const clock::time_point start = clock::now();
+
+		for (size_t i = 0; i < iterations; ++i)
+			op();
+
+		elapsed = std::chrono::duration<double>(clock::now() - start).count();
+		allocs = alloc_count.load() - allocs_before;
+		bytes = alloc_bytes.load() - bytes_before;
+
+		if (elapsed >= opts.min_time)
+			break;
+
+		// aim a bit past min_time, but never grow by more than 10x per round
+		const double scale = elapsed > 0 ? 1.2 * opts.min_time / elapsed : 10;
+		iterations = size_t(iterations * (scale < 10 ? (scale > 2 ? scale : 2) : 10));
+	}
+
+	const double ns_per_op = elapsed * 1e9 / iterations;
+	fprintf(results, "%s,%zu,%zu,%.1f,%.0f,%.2f,%.0f\n",
+			name, items, iterations, ns_per_op,
+			items * iterations / elapsed,
+			double(allocs) / iterations,
+			double(bytes) / iterations);
+	fflush(results);
+}
+
+// Pseudo random but reproducible input
+float frand(unsigned & state){
+	state = state * 1664525u + 1013904223u;
+	return (state >> 8) * (1.f / 16777216.f);
+}
+
+// A grid mesh of about triangles triangles as non indexed triangle soup,
+// every inner vertex shared by six triangles, like a loaded OBJ model
+void make_mesh(size_t triangles,
+		std::vector<glm::vec3> & vertices, std::vector<glm::vec2> & uvs, std::vector<glm::vec3> & normals)
+{
+	size_t side = 1;
+	while (2 * side * side < triangles)
+		++side;
+
+	vertices.clear();
+	uvs.clear();
+	normals.clear();
+
+	auto corner = [&](size_t i, size_t j){
+		const float u = float(i) / side;
+		const float v = float(j) / side;
+		vertices.push_back(glm::vec3(u, 0.1f * sinf(6 * u) * cosf(6 * v), v));
+		uvs.push_back(glm::vec2(u, v));
+		normals.push_back(glm::vec3(0, 1, 0));
+	};
+
+	for (size_t j = 0; j < side; ++j){
+		for (size_t i = 0; i < side; ++i){
+			corner(i, j); corner(i + 1, j); corner(i + 1, j + 1);
+			corner(i, j); corner(i + 1, j + 1); corner(i, j + 1);
+		}
+	}
+}
+
+bool write_obj(const char * path, const std::vector<glm::vec3> & vertices, const std::vector<glm::vec2> & uvs, const std::vector<glm::vec3> & normals)
+{
+	FILE * file = fopen(path, "w");
+	if (file == nullptr)
+		return false;
+
+	for (const glm::vec3 & v : vertices)
+		fprintf(file, "v %f %f %f\n", v.x, v.y, v.z);
+	for (const glm::vec2 & uv : uvs)
+		fprintf(file, "vt %f %f\n", uv.x, uv.y);
+	for (const glm::vec3 & n : normals)
+		fprintf(file, "vn %f %f %f\n", n.x, n.y, n.z);
+	for (size_t i = 0; i + 2 < vertices.size(); i += 3)
+		fprintf(file, "f %zu/%zu/%zu %zu/%zu/%zu %zu/%zu/%zu\n",
+				i + 1, i + 1, i + 1, i + 2, i + 2, i + 2, i + 3, i + 3, i + 3);
+
+	fclose(file);
+	return true;
+}
+
+void bench_flight(const BenchOptions & opts)
+{
+	Ship ship(glm::vec3(1, 0, 0), 0.5, false);
+
+	const glm::mat4 P = glm::perspective(glm::radians(45.f), 4.f / 3.f, 0.1f, 100.f);
+	const glm::mat4 V = glm::lookAt(glm::vec3(0, 10, 15), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+
+	run(opts, "ship_calc_position", opts.size, [&]{
+		for (size_t i = 0; i < opts.size; ++i)
+			consume(ship.calc_position(i * 1e-3));
+	});
+
+	run(opts, "ship_calcMVP", opts.size, [&]{
+		for (size_t i = 0; i < opts.size; ++i)
+			consume(ship.calcMVP(V, P));
+	});
+
+	std::vector<glm::vec3> headings(opts.size);
+	unsigned state = 1;
+	for (glm::vec3 & h : headings)
+		h = glm::normalize(glm::vec3(frand(state) - .5f, frand(state) - .5f, frand(state) - .5f));
+
+	run(opts, "ship_model_matrix", opts.size, [&]{
+		for (size_t i = 0; i < opts.size; ++i)
+			consume(ship_model_matrix(glm::vec3(1, 2, 3), headings[i]));
+	});
+
+	// a fleet's orbits, one by one and as a batch
+	std::vector<double> delta_theta(opts.size), radius(opts.size);
+	TrajectorySet trajectories;
+	for (size_t i = 0; i < opts.size; ++i){
+		delta_theta[i] = 2 * M_PI * i / opts.size;
+		radius[i] = 2 + 6 * fmod(i * 0.618033988749895, 1.0);
+		add_orbit(trajectories, delta_theta[i], radius[i]);
+	}
+
+	double t = 0;
+	run(opts, "orbit_position", opts.size, [&]{
+		t += 1 / 60.0;
+		for (size_t i = 0; i < opts.size; ++i)
+			consume(orbit_position(t, delta_theta[i], radius[i]));
+	});
+
+	std::vector<glm::vec3> positions;
+	run(opts, "trajectories_evaluate", opts.size, [&]{
+		t += 1 / 60.0;
+		trajectories.evaluate(t, positions);
+		consume(positions[0]);
+	});
+}
+
+void bench_clipping(const BenchOptions & opts)
+{
+	// vertices around and behind the camera, so every clipping case shows up
+	std::vector<glm::vec3> vertices(opts.size);
+	unsigned state = 2;
+	for (glm::vec3 & v : vertices)
+		v = glm::vec3(40 * frand(state) - 20, 4 * frand(state) - 2, 40 * frand(state) - 20);
+
+	std::vector<LineSegment> segments(opts.size);
+	for (size_t i = 0; i < opts.size; ++i)
+		segments[i] = LineSegment{unsigned(i), unsigned(size_t(frand(state) * opts.size) % opts.size)};
+
+	const glm::mat4 MVP = glm::perspective(glm::radians(45.f), 4.f / 3.f, 0.1f, 100.f)
+			* glm::lookAt(glm::vec3(0, 10, 15), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+
+	const VertexArraySoA soa(vertices);
+	ProjectedVertices projected;
+	project_vertices(soa, MVP, 1024, 768, projected);
+
+	ClippedSegments clipped;
+	run(opts, "clip_segments", opts.size, [&]{
+		clip_segments(projected, segments, 1024, 768, clipped);
+		consume(float(clipped.size()));
+	});
+}
+
+void bench_spatial(const BenchOptions & opts)
+{
+	// a fleet of opts.size flyers on their orbits as Fleet lays them out,
+	// at two consecutive frames so refit sees every flyer move
+	std::vector<glm::vec3> frames[2];
+	for (int k = 0; k < 2; ++k){
+		for (size_t i = 0; i < opts.size; ++i){
+			const double f = fmod(i * 0.618033988749895, 1.0);
+			frames[k].push_back(orbit_position(k / 60.0, 2 * M_PI * i / opts.size, 2 + 6 * f));
+		}
+	}
+	const std::vector<glm::vec3> & positions = frames[0];
+
+	SphereBvh bvh;
+	bvh.build(positions, ship_bounding_radius);
+
+	size_t frame = 0;
+	run(opts, "bvh_refit", opts.size, [&]{
+		bvh.refit(frames[++frame % 2]);
+	});
+	bvh.refit(positions);
+
+	const glm::mat4 P = glm::perspective(glm::radians(45.f), 4.f / 3.f, 0.1f, 100.f);
+	const glm::mat4 V = glm::lookAt(glm::vec3(0, 2, 12), glm::vec3(6, 0, 0), glm::vec3(0, 1, 0));
+	const Frustum frustum(P * V);
+
+	std::vector<unsigned char> visible;
+	run(opts, "cull_spheres", opts.size, [&]{
+		consume(float(cull_spheres(frustum, positions, ship_bounding_radius, visible)));
+	});
+
+	std::vector<unsigned> found;
+	run(opts, "bvh_query_frustum", opts.size, [&]{
+		bvh.query_frustum(frustum, found);
+		consume(float(found.size()));
+	});
+
+	run(opts, "bvh_query_radius", opts.size, [&]{
+		bvh.query_radius(positions[0], 1.f, found);
+		consume(float(found.size()));
+	});
+
+	const Ray ray = ray_through_pixel(512, 384, 1024, 768, V, P);
+	run(opts, "bvh_raycast", opts.size, [&]{
+		unsigned item = 0;
+		float distance = 0;
+		bvh.raycast(ray, item, distance);
+		consume(distance);
+	});
+
+	// opts.size x opts.size cells; the cost should not grow with it
+	const GroundGrid ground(float(opts.size), 1);
+	std::vector<GridChunk> chunks;
+	run(opts, "ground_grid_select", opts.size, [&]{
+		ground.select(view_eye(V), frustum, chunks);
+		consume(float(chunks.size()));
+	});
+}
+
+void bench_projection(const BenchOptions & opts)
+{
+	std::vector<glm::vec3> vertices(opts.size);
+	unsigned state = 3;
+	for (glm::vec3 & v : vertices)
+		v = glm::vec3(10 * frand(state) - 5, frand(state), 10 * frand(state) - 5);
+
+	const glm::mat4 MVP = glm::perspective(glm::radians(45.f), 4.f / 3.f, 0.1f, 100.f)
+			* glm::lookAt(glm::vec3(0, 10, 15), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+	const int width = 1024;
+	const int height = 768;
+
+	// the per vertex glm loop the drawables used before project_vertices,
+	// as Grid::draw had it, allocations included
+	run(opts, "project_glm_loop", opts.size, [&]{
+		const int frame_w = width;
+		const int frame_h = height;
+
+		std::vector<cv::Point2d> points;
+		std::vector<bool> visible;
+
+		for (const glm::vec3 & v3 : vertices){
+			glm::vec4 v4 = {v3.x, v3.y, v3.z, 1};
+			v4 = MVP * v4;
+			cv::Point2d p;
+
+			p.x = v4.x / v4.w * frame_w / 2 + frame_w / 2;
+			p.y = frame_h - (v4.y / v4.w * frame_h / 2 + frame_h / 2);
+
+			visible.push_back(v4.w > 0);
+			points.push_back(p);
+		}
+		consume(float(points[0].x) + visible[0]);
+	});
+
+	const VertexArraySoA soa(vertices);
+	ProjectedVertices projected;
+	run(opts, "project_vertices", opts.size, [&]{
+		project_vertices(soa, MVP, width, height, projected);
+		consume(projected.x[0]);
+	});
+}
+
+void bench_raster(const BenchOptions & opts)
+{
+	// short 2 px lines and markers spread over a 720p frame, drawn on the
+	// calling thread through OpenCV and through the span rasterizer
+	const cv::Size size(1280, 720);
+	cv::Mat frame(size, CV_8UC3, cv::Scalar(0, 0, 0));
+	const cv::Scalar color(200, 120, 40);
+
+	std::vector<float> x1(opts.size), y1(opts.size), x2(opts.size), y2(opts.size);
+	std::vector<unsigned char> visible(opts.size, 1);
+	unsigned state = 6;
+	for (size_t i = 0; i < opts.size; ++i){
+		x1[i] = size.width * frand(state);
+		y1[i] = size.height * frand(state);
+		x2[i] = x1[i] + 80 * frand(state) - 40;
+		y2[i] = y1[i] + 80 * frand(state) - 40;
+	}
+
+	TileRasterizer raster;
+
+	run(opts, "cv_lines", opts.size, [&]{
+		raster.begin_frame(size);
+		for (size_t i = 0; i < opts.size; ++i)
+			raster.line(cv::Point2d(x1[i], y1[i]), cv::Point2d(x2[i], y2[i]), color, 2, 1);
+		raster.rasterize(frame);
+	});
+
+	run(opts, "span_lines", opts.size, [&]{
+		raster.begin_frame(size);
+		raster.lines(x1.data(), y1.data(), x2.data(), y2.data(), opts.size, color, 2);
+		raster.rasterize(frame);
+	});
+
+	run(opts, "cv_markers", opts.size, [&]{
+		raster.begin_frame(size);
+		for (size_t i = 0; i < opts.size; ++i)
+			raster.circle(cv::Point2d(x1[i], y1[i]), 2, color, 2, 1);
+		raster.rasterize(frame);
+	});
+
+	run(opts, "span_markers", opts.size, [&]{
+		raster.begin_frame(size);
+		raster.markers(x1.data(), y1.data(), visible.data(), opts.size, color, 3);
+		raster.rasterize(frame);
+	});
+
+	// depth tested triangles of the same spread and extent
+	std::vector<TriangleSetup> triangles;
+	for (size_t i = 0; i < opts.size; ++i){
+		const float x[3] = {x1[i], x2[i], x1[i] + 80 * frand(state) - 40};
+		const float y[3] = {y1[i], y2[i], y1[i] + 80 * frand(state) - 40};
+		const float z[3] = {frand(state), frand(state), frand(state)};
+		TriangleSetup triangle;
+		if (setup_triangle(x, y, z, color, size, triangle))
+			triangles.push_back(triangle);
+	}
+
+	run(opts, "depth_triangles", opts.size, [&]{
+		raster.begin_frame(size);
+		raster.triangles(triangles.data(), triangles.size());
+		raster.rasterize(frame);
+	});
+}
+
+void bench_mesh(const BenchOptions & opts)
+{
+	std::vector<glm::vec3> vertices, normals;
+	std::vector<glm::vec2> uvs;
+	make_mesh(opts.size, vertices, uvs, normals);
+	const size_t triangles = vertices.size() / 3;
+
+	// unsigned short indices: keep the unique vertex count in range
+	if (vertices.size() > 6 * 32768){
+		fprintf(stderr, "--size %zu is too large for the indexer benchmarks\n", opts.size);
+		return;
+	}
+
+	std::vector<unsigned short> indices;
+	std::vector<glm::vec3> out_vertices, out_normals;
+	std::vector<glm::vec2> out_uvs;
+
+	run(opts, "indexVBO", vertices.size(), [&]{
+		indices.clear(); out_vertices.clear(); out_uvs.clear(); out_normals.clear();
+		indexVBO(vertices, uvs, normals, indices, out_vertices, out_uvs, out_normals);
+		consume(float(out_vertices.size()));
+	});
+
+	run(opts, "indexVBO_slow", vertices.size(), [&]{
+		indices.clear(); out_vertices.clear(); out_uvs.clear(); out_normals.clear();
+		indexVBO_slow(vertices, uvs, normals, indices, out_vertices, out_uvs, out_normals);
+		consume(float(out_vertices.size()));
+	});
+
+	std::vector<glm::vec3> tangents, bitangents;
+	run(opts, "computeTangentBasis", triangles, [&]{
+		tangents.clear();
+		bitangents.clear();
+		computeTangentBasis(vertices, uvs, normals, tangents, bitangents);
+		consume(tangents[0]);
+	});
+
+	const std::string path = "flyers_bench_mesh.obj";
+	if (not write_obj(path.c_str(), vertices, uvs, normals)){
+		fprintf(stderr, "Can't write %s, skipping loadOBJ\n", path.c_str());
+		return;
+	}
+
+	run(opts, "loadOBJ", triangles, [&]{
+		std::vector<glm::vec3> v, n;
+		std::vector<glm::vec2> uv;
+		loadOBJ(path.c_str(), v, uv, n);
+		consume(float(v.size()));
+	});
+
+	remove(path.c_str());
+}
+
+void bench_quaternions(const BenchOptions & opts)
+{
+	std::vector<glm::vec3> from(opts.size), to(opts.size);
+	unsigned state = 4;
+	for (size_t i = 0; i < opts.size; ++i){
+		from[i] = glm::vec3(frand(state) - .5f, frand(state) - .5f, frand(state) - .5f);
+		to[i] = glm::vec3(frand(state) - .5f, frand(state) - .5f, frand(state) - .5f);
+	}
+
+	std::vector<glm::quat> rotations(opts.size);
+	run(opts, "RotationBetweenVectors", opts.size, [&]{
+		for (size_t i = 0; i < opts.size; ++i)
+			rotations[i] = RotationBetweenVectors(from[i], to[i]);
+		consume(rotations[0]);
+	});
+
+	run(opts, "RotateTowards", opts.size, [&]{
+		glm::quat q;
+		for (size_t i = 0; i + 1 < opts.size; ++i)
+			q = RotateTowards(rotations[i], rotations[i + 1], 0.05f);
+		consume(q);
+	});
+}
+
+void bench_threads(const BenchOptions & opts)
+{
+	ThreadPool pool;
+
+	std::vector<float> values(opts.size);
+	run(opts, "parallel_for_ranges", opts.size, [&]{
+		pool.parallel_for_ranges(values.size(), 0, [&](size_t begin, size_t end){
+			for (size_t i = begin; i < end; ++i)
+				values[i] += 1;
+		});
+	});
+
+	// a whole fleet tick: trajectories, orientations, model matrices and the BVH refit
+	Fleet serial(opts.size, false);
+	Fleet parallel(opts.size, false, &pool);
+	SimClock clock = SimClock::fixed_step(1 / 60.0);
+
+	run(opts, "fleet_update", opts.size, [&]{
+		clock.tick();
+		serial.update(clock);
+	});
+
+	run(opts, "fleet_update_pool", opts.size, [&]{
+		clock.tick();
+		parallel.update(clock);
+	});
+}
+
+void print_usage(const char * argv0)
+{
+	fprintf(stderr,
+			"Usage: %s [options]\n"
+			"  --min-time S      run every benchmark for at least S seconds (default 0.5)\n"
+			"  --size N          items per op: vertices, segments or triangles (default 1024)\n"
+			"  --filter TEXT     only run benchmarks whose name contains TEXT\n",
+			argv0);
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+	BenchOptions opts;
+
+	for (int i = 1; i < argc; ++i){
+		const char * arg = argv[i];
+		const bool has_value = i + 1 < argc;
+
+		if (strcmp(arg, "--min-time") == 0 and has_value){
+			opts.min_time = atof(argv[++i]);
+		} else if (strcmp(arg, "--size") == 0 and has_value){
+			opts.size = strtoul(argv[++i], nullptr, 10);
+		} else if (strcmp(arg, "--filter") == 0 and has_value){
+			opts.filter = argv[++i];
+		} else {
+			print_usage(argv[0]);
+			return -1;
+		}
+	}
+
+	if (opts.size == 0){
+		print_usage(argv[0]);
+		return -1;
+	}
+
+	// the results get their own handle on stdout
+	results = take_stdout(false);
+	if (results == nullptr){
+		fprintf(stderr, "Can't duplicate stdout\n");
+		return -1;
+	}
+
+	fprintf(results, "benchmark,items,iterations,ns_per_op,items_per_s,allocs_per_op,bytes_per_op\n");
+
+	bench_flight(opts);
+	bench_clipping(opts);
+	bench_spatial(opts);
+	bench_projection(opts);
+	bench_raster(opts);
+	bench_mesh(opts);
+	bench_quaternions(opts);
+	bench_threads(opts);
+
+	fclose(results);
+	return 0;
+}
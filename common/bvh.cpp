@@ -0,0 +1,297 @@
+#include <algorithm>
+#include <limits>
+
+#include "bvh.hpp"
+
+namespace {
+
+const unsigned LEAF_SIZE = 4;
+// deep enough for any tree build_node makes from 32 bit item counts
+const int MAX_DEPTH = 64;
+// refit keeps the tree until its boxes cover this much more area than at build time
+const float MAX_COST_GROWTH = 2.f;
+
+float half_area(const glm::vec3 & lo, const glm::vec3 & hi){
+	const glm::vec3 d = hi - lo;
+	return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+// Distance along the ray to the box, or a negative value when it misses
+float ray_box(const Ray & ray, const glm::vec3 & inv_dir, const glm::vec3 & lo, const glm::vec3 & hi, float t_max){
+	float t0 = 0;
+	float t1 = t_max;
+	for (int a = 0; a < 3; ++a){
+		float near_t = (lo[a] - ray.origin[a]) * inv_dir[a];
+		float far_t = (hi[a] - ray.origin[a]) * inv_dir[a];
+		if (near_t > far_t)
+			std::swap(near_t, far_t);
+		t0 = std::max(t0, near_t);
+		t1 = std::min(t1, far_t);
+		if (t0 > t1)
+			return -1;
+	}
+	return t0;
+}
+
+}
+
+void SphereBvh::build(const std::vector<glm::vec3> & centers_, float radius_)
+{
+	radius = radius_;
+
+	items.resize(centers_.size());
+	for (size_t i = 0; i < items.size(); ++i)
+		items[i] = unsigned(i);
+
+	// build_node sorts through the leaf order copy
+	centers = centers_;
+
+	nodes.clear();
+	if (not items.empty())
+		build_node(0, unsigned(items.size()));
+
+	// centers follow items from now on
+	for (size_t i = 0; i < items.size(); ++i)
+		centers[i] = centers_[items[i]];
+
+	built_cost = cost();
+	++build_count;
+}
+
+unsigned SphereBvh::build_node(unsigned first, unsigned count)
+{
+	const unsigned index = unsigned(nodes.size());
+	nodes.push_back(Node());
+
+	glm::vec3 lo(std::numeric_limits<float>::max());
+	glm::vec3 hi(-std::numeric_limits<float>::max());
+	glm::vec3 centroid_lo = lo;
+	glm::vec3 centroid_hi = hi;
+	for (unsigned i = first; i < first + count; ++i){
+		const glm::vec3 & c = centers[items[i]];
+		centroid_lo = glm::min(centroid_lo, c);
+		centroid_hi = glm::max(centroid_hi, c);
+	}
+	lo = centroid_lo - glm::vec3(radius);
+	hi = centroid_hi + glm::vec3(radius);
+
+	nodes[index].lo = lo;
+	nodes[index].hi = hi;
+	nodes[index].first = first;
+	nodes[index].count = count;
+	nodes[index].right = 0;
+
+	if (count <= LEAF_SIZE)
+		return index;
+
+	// median split along the longest axis of the centers
+	const glm::vec3 extent = centroid_hi - centroid_lo;
+	int axis = 0;
+	if (extent.y > extent[axis])
+		axis = 1;
+	if (extent.z > extent[axis])
+		axis = 2;
+
+	const unsigned half = count / 2;
+	std::nth_element(items.begin() + first, items.begin() + first + half, items.begin() + first + count,
+			[this, axis](unsigned a, unsigned b){ return centers[a][axis] < centers[b][axis]; });
+
+	nodes[index].count = 0;
+	build_node(first, half);
+	const unsigned right = build_node(first + half, count - half);
+	nodes[index].right = right;
+	return index;
+}
+
+float SphereBvh::cost() const
+{
+	float sum = 0;
+	for (const Node & node : nodes)
+		sum += half_area(node.lo, node.hi);
+	return sum;
+}
+
+void SphereBvh::refit(const std::vector<glm::vec3> & centers_)
+{
+	if (centers_.size() != items.size() or items.empty()){
+		build(centers_, radius);
+		return;
+	}
+
+	for (size_t i = 0; i < items.size(); ++i)
+		centers[i] = centers_[items[i]];
+
+	// children follow their parent, so a reverse walk sees them first
+	float sum = 0;
+	for (size_t n = nodes.size(); n-- > 0;){
+		Node & node = nodes[n];
+		if (node.count > 0){
+			glm::vec3 lo = centers[node.first];
+			glm::vec3 hi = lo;
+			for (unsigned i = node.first + 1; i < node.first + node.count; ++i){
+				lo = glm::min(lo, centers[i]);
+				hi = glm::max(hi, centers[i]);
+			}
+			node.lo = lo - glm::vec3(radius);
+			node.hi = hi + glm::vec3(radius);
+		} else {
+			const Node & left = nodes[n + 1];
+			const Node & right = nodes[node.right];
+			node.lo = glm::min(left.lo, right.lo);
+			node.hi = glm::max(left.hi, right.hi);
+		}
+		sum += half_area(node.lo, node.hi);
+	}
+
+	if (sum > MAX_COST_GROWTH * built_cost)
+		build(centers_, radius);
+}
+
+void SphereBvh::query_frustum(const Frustum & frustum, std::vector<unsigned> & out) const
+{
+	out.clear();
+	if (nodes.empty())
+		return;
+
+	unsigned stack[MAX_DEPTH];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0){
+		const unsigned index = stack[--top];
+		const Node & node = nodes[index];
+
+		// p-vertex test for rejection, n-vertex test for full containment
+		bool inside = true;
+		bool outside = false;
+		for (int p = 0; p < Frustum::PLANES and not outside; ++p){
+			const glm::vec4 & plane = frustum.plane(p);
+			const glm::vec3 positive(
+					plane.x >= 0 ? node.hi.x : node.lo.x,
+					plane.y >= 0 ? node.hi.y : node.lo.y,
+					plane.z >= 0 ? node.hi.z : node.lo.z);
+			const glm::vec3 negative(
+					plane.x >= 0 ? node.lo.x : node.hi.x,
+					plane.y >= 0 ? node.lo.y : node.hi.y,
+					plane.z >= 0 ? node.lo.z : node.hi.z);
+			if (glm::dot(glm::vec3(plane), positive) + plane.w < 0)
+				outside = true;
+			else if (glm::dot(glm::vec3(plane), negative) + plane.w < 0)
+				inside = false;
+		}
+
+		if (outside)
+			continue;
+
+		if (inside){
+			// whole subtree: its items are contiguous in leaf order
+			const Node * last = &node;
+			while (last->count == 0)
+				last = &nodes[last->right];
+			for (unsigned i = node.first; i < last->first + last->count; ++i)
+				out.push_back(items[i]);
+			continue;
+		}
+
+		if (node.count > 0){
+			for (unsigned i = node.first; i < node.first + node.count; ++i)
+				if (frustum.intersects(centers[i], radius))
+					out.push_back(items[i]);
+			continue;
+		}
+
+		stack[top++] = node.right;
+		stack[top++] = index + 1;
+	}
+}
+
+void SphereBvh::query_radius(const glm::vec3 & center, float r, std::vector<unsigned> & out) const
+{
+	out.clear();
+	if (nodes.empty())
+		return;
+
+	const float reach = r + radius;
+	const float reach2 = reach * reach;
+
+	unsigned stack[MAX_DEPTH];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0){
+		const unsigned index = stack[--top];
+		const Node & node = nodes[index];
+
+		// squared distance from the query center to the box
+		const glm::vec3 nearest = glm::min(glm::max(center, node.lo), node.hi);
+		const glm::vec3 d = center - nearest;
+		if (glm::dot(d, d) > r * r)
+			continue;
+
+		if (node.count > 0){
+			for (unsigned i = node.first; i < node.first + node.count; ++i){
+				const glm::vec3 e = centers[i] - center;
+				if (glm::dot(e, e) <= reach2)
+					out.push_back(items[i]);
+			}
+			continue;
+		}
+
+		stack[top++] = node.right;
+		stack[top++] = index + 1;
+	}
+}
+
+bool SphereBvh::raycast(const Ray & ray, unsigned & item, float & t) const
+{
+	if (nodes.empty())
+		return false;
+
+	const float inf = std::numeric_limits<float>::max();
+	const glm::vec3 inv_dir(
+			ray.direction.x != 0 ? 1 / ray.direction.x : inf,
+			ray.direction.y != 0 ? 1 / ray.direction.y : inf,
+			ray.direction.z != 0 ? 1 / ray.direction.z : inf);
+
+	float best = inf;
+	bool hit = false;
+
+	unsigned stack[MAX_DEPTH];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0){
+		const unsigned index = stack[--top];
+		const Node & node = nodes[index];
+
+		if (ray_box(ray, inv_dir, node.lo, node.hi, best) < 0)
+			continue;
+
+		if (node.count > 0){
+			for (unsigned i = node.first; i < node.first + node.count; ++i){
+				float d;
+				if (intersect_ray_sphere(ray, centers[i], radius, d) and d < best){
+					best = d;
+					item = items[i];
+					hit = true;
+				}
+			}
+			continue;
+		}
+
+		// visit the nearer child first so the far one is usually pruned by best
+		unsigned near_child = index + 1;
+		unsigned far_child = node.right;
+		const float t_left = ray_box(ray, inv_dir, nodes[near_child].lo, nodes[near_child].hi, best);
+		const float t_right = ray_box(ray, inv_dir, nodes[far_child].lo, nodes[far_child].hi, best);
+		if (t_right >= 0 and (t_left < 0 or t_right < t_left))
+			std::swap(near_child, far_child);
+
+		stack[top++] = far_child;
+		stack[top++] = near_child;
+	}
+
+	if (hit)
+		t = best;
+	return hit;
+}
@@ -0,0 +1,55 @@
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "frustum.hpp"
+
+// Bounding volume hierarchy over moving spheres of one radius, such as the
+// flyers of a fleet. build() sorts the items into a binary tree of boxes;
+// refit() only grows and shrinks the boxes to the new positions, in one
+// bottom-up pass, and rebuilds when the boxes have grown too loose.
+// Item indices are those of the centers vector given to build().
+class SphereBvh
+{
+public:
+	void build(const std::vector<glm::vec3> & centers, float radius);
+	// centers must hold as many items as at build()
+	void refit(const std::vector<glm::vec3> & centers);
+
+	// Indices of the items that intersect the frustum / the sphere, unsorted
+	void query_frustum(const Frustum & frustum, std::vector<unsigned> & out) const;
+	void query_radius(const glm::vec3 & center, float radius, std::vector<unsigned> & out) const;
+
+	// Closest item hit by the ray origin + t * direction, t >= 0
+	bool raycast(const Ray & ray, unsigned & item, float & t) const;
+
+	size_t size() const { return items.size(); }
+	// builds so far, the first one included
+	size_t builds() const { return build_count; }
+
+private:
+	struct Node
+	{
+		glm::vec3 lo;
+		glm::vec3 hi;
+		// leaf: items[first, first + count); inner: children at right and this + 1
+		unsigned first;
+		unsigned count;
+		unsigned right;
+	};
+
+	unsigned build_node(unsigned first, unsigned count);
+	float cost() const;
+
+	std::vector<Node> nodes;        // depth first, children after their parent
+	std::vector<unsigned> items;    // item indices in leaf order
+	std::vector<glm::vec3> centers; // copy in leaf order, refreshed by refit
+	float radius = 0;
+
+	float built_cost = 0;
+	size_t build_count = 0;
+};
+
+#endif
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#include "frame_pool.hpp"
+
+namespace {
+
+const size_t page_size = 4096;
+
+unsigned char * alloc_pages(size_t bytes){
+	bytes = (bytes + page_size - 1) / page_size * page_size;
+#ifdef _WIN32
+	void * p = _aligned_malloc(bytes, page_size);
+#else
+	void * p = nullptr;
+	if (posix_memalign(&p, page_size, bytes) != 0)
+		p = nullptr;
+#endif
+	if (p == nullptr)
+		throw std::bad_alloc();
+	return static_cast<unsigned char *>(p);
+}
+
+void free_pages(unsigned char * p){
+#ifdef _WIN32
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+}
+
+FramePool::Frame::Frame(Frame && other) :
+	mat(other.mat),
+	pool(other.pool),
+	index(other.index)
+{
+	other.pool = nullptr;
+	other.mat = cv::Mat();
+}
+
+FramePool::Frame & FramePool::Frame::operator=(Frame && other)
+{
+	if (this != &other){
+		release();
+		mat = other.mat;
+		pool = other.pool;
+		index = other.index;
+		other.pool = nullptr;
+		other.mat = cv::Mat();
+	}
+	return *this;
+}
+
+FramePool::Frame::~Frame()
+{
+	release();
+}
+
+void FramePool::Frame::release()
+{
+	if (pool){
+		pool->give_back(index);
+		pool = nullptr;
+		mat = cv::Mat();
+	}
+}
+
+FramePool::FramePool(cv::Size size_, int type_, size_t capacity) :
+	size(size_),
+	type(type_),
+	buffer_bytes(size_t(size_.area()) * CV_ELEM_SIZE(type_))
+{
+	for (size_t i = 0; i < capacity; ++i)
+		free_list.push_back(allocate_buffer());
+}
+
+FramePool::~FramePool()
+{
+	// Every Frame must have been returned by now
+	for (unsigned char * b : buffers)
+		free_pages(b);
+}
+
+size_t FramePool::allocate_buffer()
+{
+	buffers.push_back(alloc_pages(buffer_bytes));
+	free_list.reserve(buffers.size());
+	return buffers.size() - 1;
+}
+
+FramePool::Frame FramePool::acquire()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	size_t index;
+	if (free_list.empty()){
+		index = allocate_buffer();
+		++allocations;
+	} else {
+		index = free_list.back();
+		free_list.pop_back();
+	}
+
+	++acquires;
+	peak_in_use = std::max(peak_in_use, buffers.size() - free_list.size());
+
+	return Frame(this, index, cv::Mat(size, type, buffers[index]));
+}
+
+void FramePool::give_back(size_t index)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	free_list.push_back(index);
+}
+
+FramePool::Stats FramePool::stats() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	Stats s;
+	s.capacity = buffers.size();
+	s.in_use = buffers.size() - free_list.size();
+	s.peak_in_use = peak_in_use;
+	s.acquires = acquires;
+	s.allocations = allocations;
+	return s;
+}
+
+void FramePool::print_stats(const char * name) const
+{
+	const Stats s = stats();
+	printf("%s: %dx%d, capacity %zu, in use %zu, peak %zu, acquires %lu, allocations after start %lu\n",
+			name, size.width, size.height,
+			s.capacity, s.in_use, s.peak_in_use, s.acquires, s.allocations);
+}
@@ -0,0 +1,85 @@
+#ifndef FRAME_POOL_HPP
+#define FRAME_POOL_HPP
+
+#include <mutex>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Pre-allocated, page aligned pixel buffers of one size and type.
+// The render loop checks a frame out, draws into it and lets the handle
+// go out of scope to return it, so the steady state allocates no pixels.
+// Buffers are only allocated when every existing one is checked out.
+// Safe to use from several threads.
+class FramePool
+{
+public:
+	struct Stats
+	{
+		size_t capacity;          // buffers owned by the pool
+		size_t in_use;            // buffers checked out right now
+		size_t peak_in_use;       // highest in_use seen
+		unsigned long acquires;   // total check outs
+		unsigned long allocations;// buffers allocated after construction
+	};
+
+	// Move only handle to a checked out buffer; returns it to the pool when destroyed
+	class Frame
+	{
+	public:
+		Frame() {}
+		Frame(Frame && other);
+		Frame & operator=(Frame && other);
+		~Frame();
+
+		Frame(const Frame &) = delete;
+		Frame & operator=(const Frame &) = delete;
+
+		// Hands the buffer back before the handle goes out of scope
+		void release();
+
+		explicit operator bool() const { return pool != nullptr; }
+
+		// Header over the pooled pixels. Do not make it reallocate (create, or
+		// use it as the destination of an operation with another size or type).
+		cv::Mat mat;
+
+	private:
+		friend class FramePool;
+		Frame(FramePool * pool_, size_t index_, const cv::Mat & mat_) : mat(mat_), pool(pool_), index(index_) {}
+
+		FramePool * pool = nullptr;
+		size_t index = 0;
+	};
+
+	FramePool(cv::Size size, int type = CV_8UC3, size_t capacity = 3);
+	~FramePool();
+
+	FramePool(const FramePool &) = delete;
+	FramePool & operator=(const FramePool &) = delete;
+
+	Frame acquire();
+
+	Stats stats() const;
+	void print_stats(const char * name) const;
+
+	cv::Size frame_size() const { return size; }
+	int frame_type() const { return type; }
+
+private:
+	void give_back(size_t index);
+	size_t allocate_buffer();
+
+	const cv::Size size;
+	const int type;
+	const size_t buffer_bytes;
+
+	mutable std::mutex mutex;
+	std::vector<unsigned char *> buffers;
+	std::vector<size_t> free_list;
+
+	size_t peak_in_use = 0;
+	unsigned long acquires = 0;
+	unsigned long allocations = 0;
+};
+
+#endif
@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <GL/glew.h>
+
+#include "frame_uniforms.hpp"
+#include "gl_state.hpp"
+
+namespace {
+
+// std140: VP, then the model matrices, all mat4 with a 64 byte stride
+const GLsizeiptr BLOCK_SIZE = (1 + FrameUniforms::MAX_OBJECTS) * sizeof(glm::mat4);
+
+}
+
+FrameUniforms::FrameUniforms(int frames) : fences(frames, GLsync(0))
+{
+	// regions start at offsets glBindBufferRange accepts
+	GLint alignment = 256;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	stride = (BLOCK_SIZE + alignment - 1) / alignment * alignment;
+
+	const GLsizeiptr bytes = stride * frames;
+
+	glGenBuffers(1, &buffer);
+	gl_state().bind_buffer(GL_UNIFORM_BUFFER, buffer);
+
+#ifdef GL_ARB_buffer_storage
+	if (GLEW_ARB_buffer_storage){
+		// coherent, so plain stores reach the GPU without explicit flushes
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_UNIFORM_BUFFER, bytes, nullptr, flags);
+		mapped_buffer = static_cast<char *>(glMapBufferRange(GL_UNIFORM_BUFFER, 0, bytes, flags));
+	}
+#endif
+
+	if (mapped_buffer == nullptr){
+		if (GLEW_ARB_buffer_storage)
+			fprintf(stderr, "Persistent uniform buffer mapping failed, mapping per frame\n");
+		glBufferData(GL_UNIFORM_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+	}
+
+	gl_state().bind_buffer(GL_UNIFORM_BUFFER, 0);
+}
+
+FrameUniforms::~FrameUniforms()
+{
+	if (mapped_buffer or region){
+		gl_state().bind_buffer(GL_UNIFORM_BUFFER, buffer);
+		glUnmapBuffer(GL_UNIFORM_BUFFER);
+		gl_state().bind_buffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	for (GLsync fence : fences)
+		if (fence)
+			glDeleteSync(fence);
+	glDeleteBuffers(1, &buffer);
+	gl_state().invalidate();
+}
+
+void FrameUniforms::bind_block(GLuint program)
+{
+	const GLuint index = glGetUniformBlockIndex(program, "FrameData");
+	if (index != GL_INVALID_INDEX)
+		glUniformBlockBinding(program, index, BINDING);
+}
+
+void FrameUniforms::begin_frame(const glm::mat4 & VP)
+{
+	GLsync & fence = fences[current];
+	if (fence){
+		// flush on the first check so the fence is guaranteed to signal eventually
+		GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		if (status == GL_TIMEOUT_EXPIRED){
+			++wait_count;
+			while (status == GL_TIMEOUT_EXPIRED)
+				status = glClientWaitSync(fence, 0, 100000000); // 100 ms
+		}
+		glDeleteSync(fence);
+		fence = 0;
+	}
+
+	if (mapped_buffer){
+		region = mapped_buffer + current * stride;
+	} else {
+		// the fence above already made sure the GPU is done with this region
+		gl_state().bind_buffer(GL_UNIFORM_BUFFER, buffer);
+		region = static_cast<char *>(glMapBufferRange(GL_UNIFORM_BUFFER, current * stride, stride,
+				GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+	}
+
+	objects = 0;
+	if (region)
+		memcpy(region, &VP[0][0], sizeof(glm::mat4));
+}
+
+int FrameUniforms::add_object(const glm::mat4 & model)
+{
+	if (region == nullptr or objects == MAX_OBJECTS)
+		return -1;
+
+	memcpy(region + (1 + objects) * sizeof(glm::mat4), &model[0][0], sizeof(glm::mat4));
+	return objects++;
+}
+
+void FrameUniforms::commit()
+{
+	if (not mapped_buffer and region){
+		gl_state().bind_buffer(GL_UNIFORM_BUFFER, buffer);
+		glUnmapBuffer(GL_UNIFORM_BUFFER);
+	}
+	region = nullptr;
+
+	gl_state().bind_buffer_range(GL_UNIFORM_BUFFER, BINDING, buffer, current * stride, BLOCK_SIZE);
+}
+
+void FrameUniforms::end_frame()
+{
+	fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	current = (current + 1) % fences.size();
+}
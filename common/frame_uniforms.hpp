@@ -0,0 +1,66 @@
+#ifndef FRAME_UNIFORMS_HPP
+#define FRAME_UNIFORMS_HPP
+
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// Per frame transforms of every GL drawable in one uniform buffer.
+// The buffer holds a ring of regions, one per frame in flight, each laid out
+// as the std140 block
+//
+//     layout(std140) uniform FrameData { mat4 VP; mat4 Models[MAX_OBJECTS]; };
+//
+// Shaders pick their model matrix with the ObjectID uniform. A frame writes
+// its region front to back, so all transforms go to the GPU in one contiguous
+// write, and a fence per region keeps the CPU from overwriting a region the
+// GPU still reads. Where ARB_buffer_storage is available the whole buffer is
+// mapped once, persistently; otherwise each frame maps its own region unsynchronized.
+class FrameUniforms
+{
+public:
+	static const int MAX_OBJECTS = 64;
+	// uniform buffer binding point of the FrameData block
+	static const GLuint BINDING = 0;
+
+	explicit FrameUniforms(int frames = 3);
+	~FrameUniforms();
+
+	FrameUniforms(const FrameUniforms &) = delete;
+	FrameUniforms & operator=(const FrameUniforms &) = delete;
+
+	// Attaches the FrameData block of program to BINDING; programs without the block are left alone
+	static void bind_block(GLuint program);
+
+	// Starts writing the next region; waits only if the GPU still reads it
+	void begin_frame(const glm::mat4 & VP);
+	// Stores a model matrix for this frame and returns the ObjectID to draw it
+	// with, or -1 once MAX_OBJECTS objects were added
+	int add_object(const glm::mat4 & model);
+	// Finishes the writes and binds the region; call before the frame's draws
+	void commit();
+	// Fences the region; call after the frame's draws were issued
+	void end_frame();
+
+	bool persistent() const { return mapped_buffer != nullptr; }
+	// Frames that had to wait for the GPU before writing their region
+	unsigned long waits() const { return wait_count; }
+
+private:
+	GLuint buffer;
+	GLsizeiptr stride;
+
+	std::vector<GLsync> fences;
+	size_t current = 0;
+
+	// whole buffer, when mapped persistently
+	char * mapped_buffer = nullptr;
+	// region of the current frame while it is written
+	char * region = nullptr;
+	int objects = 0;
+
+	unsigned long wait_count = 0;
+};
+
+#endif
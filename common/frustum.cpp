@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+
+#include "frustum.hpp"
+
+Frustum::Frustum(const glm::mat4 & m)
+{
+	// glm is column major: row r of the matrix is m[0][r], m[1][r], m[2][r], m[3][r]
+	auto row = [&m](int r){ return glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]); };
+
+	const glm::vec4 r0 = row(0);
+	const glm::vec4 r1 = row(1);
+	const glm::vec4 r2 = row(2);
+	const glm::vec4 r3 = row(3);
+
+	planes[LEFT]   = r3 + r0;
+	planes[RIGHT]  = r3 - r0;
+	planes[BOTTOM] = r3 + r1;
+	planes[TOP]    = r3 - r1;
+	planes[ZNEAR]  = r3 + r2;
+	planes[ZFAR]   = r3 - r2;
+
+	for (glm::vec4 & p : planes){
+		const float length = glm::length(glm::vec3(p));
+		if (length > 0)
+			p = p * (1 / length);
+	}
+}
+
+bool Frustum::intersects(const glm::vec3 & center, float radius) const
+{
+	for (const glm::vec4 & p : planes)
+		if (p.x * center.x + p.y * center.y + p.z * center.z + p.w < -radius)
+			return false;
+	return true;
+}
+
+bool Frustum::intersects(const BoundingSphere & sphere) const
+{
+	return intersects(sphere.center, sphere.radius);
+}
+
+Ray ray_through_pixel(double x, double y, int width, int height,
+		const glm::mat4 & ViewMatrix, const glm::mat4 & ProjectionMatrix)
+{
+	const glm::mat4 inverse = glm::inverse(ProjectionMatrix * ViewMatrix);
+
+	const float ndc_x = float(2 * x / width - 1);
+	const float ndc_y = float(1 - 2 * y / height);
+
+	glm::vec4 near_point = inverse * glm::vec4(ndc_x, ndc_y, -1, 1);
+	glm::vec4 far_point = inverse * glm::vec4(ndc_x, ndc_y, 1, 1);
+
+	const glm::vec3 a = glm::vec3(near_point) / near_point.w;
+	const glm::vec3 b = glm::vec3(far_point) / far_point.w;
+
+	return Ray{a, glm::normalize(b - a)};
+}
+
+bool intersect_ray_sphere(const Ray & ray, const glm::vec3 & center, float radius, float & t)
+{
+	const glm::vec3 oc = ray.origin - center;
+	const float b = glm::dot(oc, ray.direction);
+	const float c = glm::dot(oc, oc) - radius * radius;
+	const float disc = b * b - c;
+	if (disc < 0)
+		return false;
+
+	const float root = sqrtf(disc);
+	if (-b + root < 0)
+		return false;
+
+	t = std::max(-b - root, 0.f);
+	return true;
+}
+
+void CullStats::print(const char * name) const
+{
+	const unsigned long total = visible + culled;
+	printf("%s: %lu visible, %lu culled (%.1f%%)\n",
+			name, visible, culled, total ? 100.0 * culled / total : 0.0);
+}
+
+size_t cull_spheres(
+	const Frustum & frustum,
+	const std::vector<glm::vec3> & centers,
+	float radius,
+	std::vector<unsigned char> & visible
+){
+	visible.resize(centers.size());
+
+	size_t count = 0;
+	for (size_t i = 0; i < centers.size(); ++i){
+		visible[i] = frustum.intersects(centers[i], radius);
+		count += visible[i];
+	}
+	return count;
+}
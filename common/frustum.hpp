@@ -0,0 +1,66 @@
+#ifndef FRUSTUM_HPP
+#define FRUSTUM_HPP
+
+#include <vector>
+#include <glm/glm.hpp>
+
+struct BoundingSphere
+{
+	glm::vec3 center;
+	float radius;
+};
+
+// The six planes of a view volume, taken from the rows of ProjectionMatrix * ViewMatrix.
+// Plane normals point inwards and are normalized, so the plane equation is a distance.
+class Frustum
+{
+public:
+	enum { LEFT, RIGHT, BOTTOM, TOP, ZNEAR, ZFAR, PLANES };
+
+	explicit Frustum(const glm::mat4 & ViewProjection);
+
+	// false only when the sphere is entirely outside one plane; spheres
+	// near a corner may pass although they are outside, as usual for this test
+	bool intersects(const BoundingSphere & sphere) const;
+	bool intersects(const glm::vec3 & center, float radius) const;
+
+	const glm::vec4 & plane(int i) const { return planes[i]; }
+
+private:
+	glm::vec4 planes[PLANES];
+};
+
+struct Ray
+{
+	glm::vec3 origin;
+	glm::vec3 direction;    // normalized
+};
+
+// Ray from the near plane through the pixel (x, y) of a width x height
+// viewport, origin at the top left corner as in window and image coordinates
+Ray ray_through_pixel(double x, double y, int width, int height,
+		const glm::mat4 & ViewMatrix, const glm::mat4 & ProjectionMatrix);
+
+// Distance t >= 0 along the ray to the sphere surface, 0 when the ray starts inside
+bool intersect_ray_sphere(const Ray & ray, const glm::vec3 & center, float radius, float & t);
+
+// Visible and culled counts, summed over every cull pass since the start
+struct CullStats
+{
+	unsigned long visible = 0;
+	unsigned long culled = 0;
+
+	void add(bool is_visible) { is_visible ? ++visible : ++culled; }
+	void print(const char * name) const;
+};
+
+// Tests spheres of one radius around every center, visible[i] = 1 when
+// sphere i intersects the frustum. Returns the number of visible spheres.
+size_t cull_spheres(
+	const Frustum & frustum,
+	const std::vector<glm::vec3> & centers,
+	float radius,
+	std::vector<unsigned char> & visible
+);
+
+#endif
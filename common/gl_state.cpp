@@ -0,0 +1,165 @@
+#include <stdio.h>
+
+#include "gl_state.hpp"
+
+namespace {
+
+const char * const CALL_NAMES[GlState::CALLS] = {
+	"glUseProgram",
+	"glBindVertexArray",
+	"glBindBuffer",
+	"glBindBufferRange",
+	"glPolygonMode",
+	"glEnable/glDisable",
+	"glPixelStorei",
+};
+
+}
+
+GlState::GlState()
+{
+	invalidate();
+	for (int i = 0; i < CALLS; ++i){
+		issued_count[i] = 0;
+		elided_count[i] = 0;
+	}
+}
+
+void GlState::invalidate()
+{
+	program_known = false;
+	vao_known = false;
+	polygon_known = false;
+	pack_known = false;
+	buffer_count = 0;
+	capability_count = 0;
+	for (Range & range : uniform_ranges)
+		range.known = false;
+}
+
+bool GlState::changes(Call call, bool differs)
+{
+	if (differs)
+		++issued_count[call];
+	else
+		++elided_count[call];
+	return differs;
+}
+
+void GlState::use_program(GLuint program_)
+{
+	if (not changes(USE_PROGRAM, not program_known or program != program_))
+		return;
+	glUseProgram(program_);
+	program = program_;
+	program_known = true;
+}
+
+void GlState::bind_vertex_array(GLuint vao_)
+{
+	if (not changes(BIND_VERTEX_ARRAY, not vao_known or vao != vao_))
+		return;
+	glBindVertexArray(vao_);
+	vao = vao_;
+	vao_known = true;
+}
+
+void GlState::bind_buffer(GLenum target, GLuint buffer)
+{
+	Binding * binding = nullptr;
+	for (int i = 0; i < buffer_count and not binding; ++i)
+		if (buffers[i].target == target)
+			binding = &buffers[i];
+
+	if (not changes(BIND_BUFFER, binding == nullptr or binding->name != buffer))
+		return;
+
+	glBindBuffer(target, buffer);
+
+	if (binding == nullptr and buffer_count < MAX_BUFFER_TARGETS){
+		binding = &buffers[buffer_count++];
+		binding->target = target;
+	}
+	if (binding)
+		binding->name = buffer;
+}
+
+void GlState::bind_buffer_range(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+	Range * range = target == GL_UNIFORM_BUFFER and index < GLuint(MAX_UNIFORM_BINDINGS) ? &uniform_ranges[index] : nullptr;
+	const bool differs = range == nullptr or not range->known
+			or range->buffer != buffer or range->offset != offset or range->size != size;
+
+	if (not changes(BIND_BUFFER_RANGE, differs))
+		return;
+
+	glBindBufferRange(target, index, buffer, offset, size);
+	if (range)
+		*range = Range{true, buffer, offset, size};
+
+	// the generic binding point now holds the buffer too
+	for (int i = 0; i < buffer_count; ++i)
+		if (buffers[i].target == target)
+			buffers[i].name = buffer;
+}
+
+void GlState::polygon_mode(GLenum mode)
+{
+	if (not changes(POLYGON_MODE, not polygon_known or polygon != mode))
+		return;
+	glPolygonMode(GL_FRONT_AND_BACK, mode);
+	polygon = mode;
+	polygon_known = true;
+}
+
+void GlState::pack_alignment(GLint alignment)
+{
+	if (not changes(PIXEL_STORE, not pack_known or pack != alignment))
+		return;
+	glPixelStorei(GL_PACK_ALIGNMENT, alignment);
+	pack = alignment;
+	pack_known = true;
+}
+
+void GlState::set_enabled(GLenum capability, bool enabled)
+{
+	Capability * known = nullptr;
+	for (int i = 0; i < capability_count and not known; ++i)
+		if (capabilities[i].capability == capability)
+			known = &capabilities[i];
+
+	if (not changes(CAPABILITY, known == nullptr or known->enabled != enabled))
+		return;
+
+	if (enabled)
+		glEnable(capability);
+	else
+		glDisable(capability);
+
+	if (known == nullptr and capability_count < MAX_CAPABILITIES)
+		known = &capabilities[capability_count++];
+	if (known)
+		*known = Capability{capability, enabled};
+}
+
+void GlState::print_stats(const char * name, unsigned long frames) const
+{
+	const double n = frames > 0 ? double(frames) : 1.0;
+	unsigned long issued_total = 0;
+	unsigned long elided_total = 0;
+	for (int i = 0; i < CALLS; ++i){
+		issued_total += issued_count[i];
+		elided_total += elided_count[i];
+	}
+
+	printf("%s: %.1f calls issued, %.1f elided per frame\n", name, issued_total / n, elided_total / n);
+	for (int i = 0; i < CALLS; ++i)
+		if (issued_count[i] + elided_count[i] > 0)
+			printf("  %-20s %8.1f issued %8.1f elided\n", CALL_NAMES[i], issued_count[i] / n, elided_count[i] / n);
+}
+
+GlState & gl_state()
+{
+	static GlState state;
+	return state;
+}
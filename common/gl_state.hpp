@@ -0,0 +1,92 @@
+#ifndef GL_STATE_HPP
+#define GL_STATE_HPP
+
+#include <GL/glew.h>
+
+// Shadow copy of the GL state the demo changes per frame. Every setter
+// compares against the copy and skips the GL call when it would not change
+// anything. Counters of issued and elided calls per kind show the driver
+// calls saved.
+// Tracks only context state: vertex array bindings, not what a vertex array
+// itself holds (attribute pointers, its element buffer).
+// Code that changes tracked state without going through here must call invalidate().
+class GlState
+{
+public:
+	enum Call { USE_PROGRAM, BIND_VERTEX_ARRAY, BIND_BUFFER, BIND_BUFFER_RANGE, POLYGON_MODE, CAPABILITY, PIXEL_STORE, CALLS };
+
+	GlState();
+
+	void use_program(GLuint program);
+	void bind_vertex_array(GLuint vao);
+	// Non indexed targets that are not vertex array state: GL_ARRAY_BUFFER,
+	// GL_UNIFORM_BUFFER, GL_PIXEL_PACK_BUFFER, ...
+	void bind_buffer(GLenum target, GLuint buffer);
+	// Indexed GL_UNIFORM_BUFFER binding; like GL, also binds the generic target
+	void bind_buffer_range(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+	// For GL_FRONT_AND_BACK, the only face core profiles accept
+	void polygon_mode(GLenum mode);
+	void set_enabled(GLenum capability, bool enabled);
+	void enable(GLenum capability) { set_enabled(capability, true); }
+	void disable(GLenum capability) { set_enabled(capability, false); }
+	// GL_PACK_ALIGNMENT, the row alignment glReadPixels writes with
+	void pack_alignment(GLint alignment);
+
+	// Forgets the shadow copy, so the next call of every kind is issued
+	void invalidate();
+
+	unsigned long issued(Call call) const { return issued_count[call]; }
+	unsigned long elided(Call call) const { return elided_count[call]; }
+	// Issued and elided calls per frame over frames frames, by kind
+	void print_stats(const char * name, unsigned long frames) const;
+
+private:
+	static const int MAX_BUFFER_TARGETS = 8;
+	static const int MAX_UNIFORM_BINDINGS = 16;
+	static const int MAX_CAPABILITIES = 8;
+
+	// true when the call is needed; counts it either way
+	bool changes(Call call, bool differs);
+
+	struct Binding
+	{
+		GLenum target;
+		GLuint name;
+	};
+	struct Range
+	{
+		bool known;
+		GLuint buffer;
+		GLintptr offset;
+		GLsizeiptr size;
+	};
+	struct Capability
+	{
+		GLenum capability;
+		bool enabled;
+	};
+
+	bool program_known;
+	GLuint program;
+	bool vao_known;
+	GLuint vao;
+	bool polygon_known;
+	GLenum polygon;
+	bool pack_known;
+	GLint pack;
+
+	// the known entries only, in first use order
+	Binding buffers[MAX_BUFFER_TARGETS];
+	int buffer_count;
+	Capability capabilities[MAX_CAPABILITIES];
+	int capability_count;
+	Range uniform_ranges[MAX_UNIFORM_BINDINGS];
+
+	unsigned long issued_count[CALLS];
+	unsigned long elided_count[CALLS];
+};
+
+// The state of the one GL context the demo renders with
+GlState & gl_state();
+
+#endif
@@ -0,0 +1,103 @@
+#include <GL/glew.h>
+
+#include "gpu_readback.hpp"
+#include "gl_state.hpp"
+
+GpuReadback::GpuReadback(int width_, int height_, int ring_size) :
+	width(width_),
+	height(height_),
+	bytes(size_t(width_) * height_ * 3)
+{
+	slots.resize(ring_size);
+
+	for (Slot & slot : slots){
+		glGenBuffers(1, &slot.pbo);
+		gl_state().bind_buffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+		glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+		slot.fence = 0;
+	}
+
+	gl_state().bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+GpuReadback::~GpuReadback()
+{
+	if (mapped)
+		unmap_oldest();
+
+	for (Slot & slot : slots){
+		if (slot.fence)
+			glDeleteSync(slot.fence);
+		glDeleteBuffers(1, &slot.pbo);
+	}
+	gl_state().invalidate();
+}
+
+void GpuReadback::queue()
+{
+	Slot & slot = slots[(head + count) % slots.size()];
+	++count;
+
+	// rows are tightly packed in the buffers
+	gl_state().pack_alignment(1);
+
+	gl_state().bind_buffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+	glReadPixels(0, 0, width, height, GL_BGR, GL_UNSIGNED_BYTE, nullptr);
+	gl_state().bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+bool GpuReadback::map_oldest(cv::Mat & view, bool wait)
+{
+	if (count == 0 or mapped)
+		return false;
+
+	Slot & slot = slots[head];
+
+	// flush on the first check so the fence is guaranteed to signal eventually
+	GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	while (wait and status == GL_TIMEOUT_EXPIRED)
+		status = glClientWaitSync(slot.fence, 0, 100000000); // 100 ms
+
+	if (status == GL_TIMEOUT_EXPIRED)
+		return false;
+
+	glDeleteSync(slot.fence);
+	slot.fence = 0;
+
+	gl_state().bind_buffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+	void * pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+	gl_state().bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	if (pixels == nullptr){
+		// frame lost, free its slot
+		head = (head + 1) % slots.size();
+		--count;
+		return false;
+	}
+
+	mapped = true;
+	view = cv::Mat(height, width, CV_8UC3, pixels);
+	return true;
+}
+
+void GpuReadback::unmap_oldest()
+{
+	if (not mapped)
+		return;
+
+	gl_state().bind_buffer(GL_PIXEL_PACK_BUFFER, slots[head].pbo);
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	gl_state().bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	mapped = false;
+	head = (head + 1) % slots.size();
+	--count;
+}
+
+void GpuReadback::copy_flipped(const cv::Mat & view, cv::Mat & dst)
+{
+	// vertical flip only; the channels are already in BGR order
+	cv::flip(view, dst, 0);
+}
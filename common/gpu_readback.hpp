@@ -0,0 +1,57 @@
+#ifndef GPU_READBACK_HPP
+#define GPU_READBACK_HPP
+
+#include <vector>
+
+#include <GL/glew.h>
+#include <opencv2/opencv.hpp>
+
+// Ring of pixel buffer objects for asynchronous glReadPixels.
+// queue() starts copying the current read framebuffer into the next buffer and
+// returns immediately; the frame is mapped a few frames later, once its fence
+// signalled, so the CPU never waits for the GPU to finish rendering.
+// Pixels are read as BGR, OpenCV's channel order, so no colour swap is needed.
+class GpuReadback
+{
+public:
+	GpuReadback(int width, int height, int ring_size = 3);
+	~GpuReadback();
+
+	GpuReadback(const GpuReadback &) = delete;
+	GpuReadback & operator=(const GpuReadback &) = delete;
+
+	// Starts reading the framebuffer bound for reading. Call before swapping
+	// buffers. The ring must not be full().
+	void queue();
+
+	// Maps the oldest queued frame. view then points straight at the mapped
+	// buffer: BGR, bottom row first, as GL stores it. Without wait, returns false
+	// if the GPU has not finished that frame yet.
+	bool map_oldest(cv::Mat & view, bool wait);
+	// Releases the frame returned by map_oldest, making its buffer free again
+	void unmap_oldest();
+
+	size_t pending() const { return count; }
+	bool full() const { return count == slots.size(); }
+
+	// Copies a mapped view into dst the right way up, in one pass
+	static void copy_flipped(const cv::Mat & view, cv::Mat & dst);
+
+private:
+	struct Slot
+	{
+		GLuint pbo;
+		GLsync fence;
+	};
+
+	const int width;
+	const int height;
+	const size_t bytes;
+
+	std::vector<Slot> slots;
+	size_t head = 0;  // oldest queued slot
+	size_t count = 0; // queued slots
+	bool mapped = false;
+};
+
+#endif
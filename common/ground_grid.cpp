@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <math.h>
+
+#include "ground_grid.hpp"
+
+namespace {
+
+// chunks closer to the camera than this many times their size are split
+const float SPLIT_DISTANCE = 2;
+
+}
+
+GroundGrid::GroundGrid(float extent, float spacing_) : spacing(spacing_)
+{
+	const int cells = std::max(1, int(roundf(extent / spacing)));
+	hi = 0.5f * cells * spacing;
+	lo = -hi;
+
+	top_level = 0;
+	while ((CHUNK_CELLS << top_level) < cells)
+		++top_level;
+}
+
+int GroundGrid::lines(float c, float step) const
+{
+	const float cells = (hi - c) / step;
+	if (cells > CHUNK_CELLS + 1e-3f)
+		return CHUNK_CELLS;
+
+	// the border may fall between two lines of a coarse chunk; the first line
+	// past it is clamped onto it
+	return std::min(CHUNK_LINES, int(ceilf(cells - 1e-3f)) + 1);
+}
+
+void GroundGrid::visit(int level, float x, float z, const glm::vec3 & eye, const Frustum & frustum,
+		std::vector<GridChunk> & chunks) const
+{
+	// children of a root that overhangs the grid may start on or past its border
+	if (hi - x < 1e-3f * spacing or hi - z < 1e-3f * spacing)
+		return;
+
+	const float size = ldexpf(CHUNK_CELLS * spacing, level);
+	const float x1 = std::min(x + size, hi);
+	const float z1 = std::min(z + size, hi);
+
+	const glm::vec3 center(0.5f * (x + x1), 0, 0.5f * (z + z1));
+	const float radius = 0.5f * sqrtf((x1 - x) * (x1 - x) + (z1 - z) * (z1 - z));
+	if (not frustum.intersects(center, radius))
+		return;
+
+	// distance from the eye to the chunk's rectangle
+	const float dx = std::max(std::max(x - eye.x, eye.x - x1), 0.f);
+	const float dz = std::max(std::max(z - eye.z, eye.z - z1), 0.f);
+	const float distance = sqrtf(dx * dx + eye.y * eye.y + dz * dz);
+
+	if (level > 0 and distance < SPLIT_DISTANCE * size){
+		const float half = 0.5f * size;
+		visit(level - 1, x, z, eye, frustum, chunks);
+		visit(level - 1, x + half, z, eye, frustum, chunks);
+		visit(level - 1, x, z + half, eye, frustum, chunks);
+		visit(level - 1, x + half, z + half, eye, frustum, chunks);
+		return;
+	}
+
+	const float step = size / CHUNK_CELLS;
+	chunks.push_back(GridChunk{x, z, size, level, lines(x, step), lines(z, step)});
+}
+
+void GroundGrid::select(const glm::vec3 & eye, const Frustum & frustum, std::vector<GridChunk> & chunks) const
+{
+	chunks.clear();
+	visit(top_level, lo, lo, eye, frustum, chunks);
+}
+
+void GroundGrid::line_x(const GridChunk & chunk, int i, glm::vec3 & a, glm::vec3 & b) const
+{
+	const float x = line(chunk.x, chunk.size, i);
+	a = glm::vec3(x, 0, chunk.z);
+	b = glm::vec3(x, 0, std::min(chunk.z + chunk.size, hi));
+}
+
+void GroundGrid::line_z(const GridChunk & chunk, int i, glm::vec3 & a, glm::vec3 & b) const
+{
+	const float z = line(chunk.z, chunk.size, i);
+	a = glm::vec3(chunk.x, 0, z);
+	b = glm::vec3(std::min(chunk.x + chunk.size, hi), 0, z);
+}
+
+glm::vec3 GroundGrid::vertex(const GridChunk & chunk, int i, int j) const
+{
+	return glm::vec3(line(chunk.x, chunk.size, i), 0, line(chunk.z, chunk.size, j));
+}
+
+BoundingSphere GroundGrid::bounds() const
+{
+	return BoundingSphere{glm::vec3(0, 0, 0), hi * sqrtf(2)};
+}
+
+glm::vec3 view_eye(const glm::mat4 & ViewMatrix)
+{
+	// ViewMatrix = [R | t] with R a rotation, so the eye is -R^T t
+	const glm::vec3 t(ViewMatrix[3]);
+	return -glm::vec3(
+			glm::dot(glm::vec3(ViewMatrix[0]), t),
+			glm::dot(glm::vec3(ViewMatrix[1]), t),
+			glm::dot(glm::vec3(ViewMatrix[2]), t));
+}
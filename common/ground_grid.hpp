@@ -0,0 +1,70 @@
+#ifndef GROUND_GRID_HPP
+#define GROUND_GRID_HPP
+
+#include <algorithm>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "frustum.hpp"
+
+// One square piece of the ground grid picked for a view
+struct GridChunk
+{
+	float x;        // corner with the smallest x and z
+	float z;
+	float size;     // side length; lines are size / GroundGrid::CHUNK_CELLS apart
+	int level;      // 0 at the grid's own spacing, one more per doubling
+	int lines_x;    // lines of constant x to draw, at most GroundGrid::CHUNK_LINES
+	int lines_z;    // lines of constant z
+};
+
+// Ground grid in the y = 0 plane, centered on the origin, with a line every
+// spacing units. Lines are never stored: every view walks a quadtree of
+// chunks of CHUNK_CELLS x CHUNK_CELLS cells, splitting chunks close to the
+// camera into four of half the size. Far chunks thus draw every 2nd, 4th, ...
+// line, the line density on screen stays about constant, and the number of
+// chunks depends on the view rather than on the grid extent.
+// A chunk draws the lines on its low x and z sides; the lines on its high
+// sides belong to its neighbours, except at the grid border.
+class GroundGrid
+{
+public:
+	static const int CHUNK_CELLS = 16;
+	static const int CHUNK_LINES = CHUNK_CELLS + 1;
+
+	// extent is rounded to a whole number of cells
+	GroundGrid(float extent, float spacing);
+
+	// Chunks that intersect the frustum, finer the closer they are to eye.
+	// Replaces the contents of chunks, reusing its storage.
+	void select(const glm::vec3 & eye, const Frustum & frustum, std::vector<GridChunk> & chunks) const;
+
+	// Ends of line i of constant x (or z) of a chunk, clamped to the grid
+	void line_x(const GridChunk & chunk, int i, glm::vec3 & a, glm::vec3 & b) const;
+	void line_z(const GridChunk & chunk, int i, glm::vec3 & a, glm::vec3 & b) const;
+	// Crossing of line i of constant x and line j of constant z
+	glm::vec3 vertex(const GridChunk & chunk, int i, int j) const;
+
+	BoundingSphere bounds() const;
+	float low() const { return lo; }
+	float high() const { return hi; }
+	int levels() const { return top_level + 1; }
+
+private:
+	void visit(int level, float x, float z, const glm::vec3 & eye, const Frustum & frustum,
+			std::vector<GridChunk> & chunks) const;
+	// Lines of one axis for a chunk starting at c, clamped to the grid
+	int lines(float c, float step) const;
+	// Position of line i of a chunk starting at c, clamped to the grid
+	float line(float c, float size, int i) const { return std::min(c + i * size / CHUNK_CELLS, hi); }
+
+	float spacing;
+	float lo;       // the grid covers [lo, hi] on both x and z
+	float hi;
+	int top_level;  // level of the single root chunk
+};
+
+// Eye position of a rigid view matrix, without a general inverse
+glm::vec3 view_eye(const glm::mat4 & ViewMatrix);
+
+#endif
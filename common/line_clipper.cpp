@@ -0,0 +1,129 @@
+#include <algorithm>
+
+#include "line_clipper.hpp"
+
+void ClippedSegments::clear(){
+	x1.clear();
+	y1.clear();
+	x2.clear();
+	y2.clear();
+	rejected = 0;
+	clipped = 0;
+}
+
+namespace {
+
+enum Outcode : unsigned char {
+	LEFT   = 1 << 0,
+	RIGHT  = 1 << 1,
+	BOTTOM = 1 << 2,
+	TOP    = 1 << 3,
+	NEAR   = 1 << 4,
+	FAR    = 1 << 5,
+};
+
+const int PLANES = 6;
+
+// Signed distances of a clip space point to the six planes, >= 0 inside
+inline void plane_distances(float x, float y, float z, float w, float d[PLANES]){
+	d[0] = w + x;
+	d[1] = w - x;
+	d[2] = w + y;
+	d[3] = w - y;
+	d[4] = w + z;
+	d[5] = w - z;
+}
+
+}
+
+void clip_segments(
+	const ProjectedVertices & v,
+	const std::vector<LineSegment> & segments,
+	int width,
+	int height,
+	ClippedSegments & out
+){
+	out.clear();
+
+	const size_t n = v.size();
+	if (out.outcodes.size() < n)
+		out.outcodes.resize(n);
+
+	const float * cx = v.cx.data();
+	const float * cy = v.cy.data();
+	const float * cz = v.cz.data();
+	const float * cw = v.w.data();
+	unsigned char * codes = out.outcodes.data();
+
+	// Branch free classification, one pass over the batch
+	for (size_t i = 0; i < n; ++i){
+		const float x = cx[i], y = cy[i], z = cz[i], w = cw[i];
+		codes[i] = (unsigned char)(
+				(x < -w) * LEFT | (x > w) * RIGHT |
+				(y < -w) * BOTTOM | (y > w) * TOP |
+				(z < -w) * NEAR | (z > w) * FAR);
+	}
+
+	const float fw = float(width);
+	const float fh = float(height);
+	// integer halves, as in project_vertices
+	const float half_w = float(width / 2);
+	const float half_h = float(height / 2);
+
+	auto emit = [&out](float x1, float y1, float x2, float y2){
+		out.x1.push_back(x1);
+		out.y1.push_back(y1);
+		out.x2.push_back(x2);
+		out.y2.push_back(y2);
+	};
+
+	for (const LineSegment & s : segments){
+		const unsigned char c1 = codes[s.a];
+		const unsigned char c2 = codes[s.b];
+
+		if (c1 & c2){
+			++out.rejected;
+			continue;
+		}
+
+		if ((c1 | c2) == 0){
+			emit(v.x[s.a], v.y[s.a], v.x[s.b], v.y[s.b]);
+			continue;
+		}
+
+		// Liang-Barsky on the homogeneous segment P(t) = A + t (B - A)
+		float da[PLANES], db[PLANES];
+		plane_distances(cx[s.a], cy[s.a], cz[s.a], cw[s.a], da);
+		plane_distances(cx[s.b], cy[s.b], cz[s.b], cw[s.b], db);
+
+		float t0 = 0;
+		float t1 = 1;
+		for (int p = 0; p < PLANES; ++p){
+			if (da[p] < 0)
+				t0 = std::max(t0, da[p] / (da[p] - db[p]));
+			else if (db[p] < 0)
+				t1 = std::min(t1, da[p] / (da[p] - db[p]));
+		}
+
+		if (t0 >= t1){
+			++out.rejected;
+			continue;
+		}
+
+		++out.clipped;
+
+		float end[2][2];
+		const float ts[2] = {t0, t1};
+		for (int k = 0; k < 2; ++k){
+			const float t = ts[k];
+			const float x = cx[s.a] + t * (cx[s.b] - cx[s.a]);
+			const float y = cy[s.a] + t * (cy[s.b] - cy[s.a]);
+			const float w = cw[s.a] + t * (cw[s.b] - cw[s.a]);
+
+			end[k][0] = x / w * fw / 2 + half_w;
+			end[k][1] = fh - (y / w * fh / 2 + half_h);
+		}
+
+		emit(end[0][0], end[0][1], end[1][0], end[1][1]);
+	}
+}
@@ -0,0 +1,48 @@
+#ifndef LINE_CLIPPER_HPP
+#define LINE_CLIPPER_HPP
+
+#include <vector>
+
+#include "projection.hpp"
+
+// One line segment between two vertices of a ProjectedVertices batch
+struct LineSegment
+{
+	unsigned a;
+	unsigned b;
+};
+
+// Screen space end points of the segments that survived clipping, in the
+// same pixel mapping as project_vertices. Kept by the caller between frames.
+struct ClippedSegments
+{
+	std::vector<float> x1;
+	std::vector<float> y1;
+	std::vector<float> x2;
+	std::vector<float> y2;
+
+	size_t rejected = 0;    // segments entirely outside the view volume
+	size_t clipped = 0;     // segments shortened by at least one plane
+
+	size_t size() const { return x1.size(); }
+	void clear();
+
+	// per vertex outcodes of the last batch
+	std::vector<unsigned char> outcodes;
+};
+
+// Clips every segment against the view volume in homogeneous clip space
+// (-w <= x, y, z <= w), so segments crossing the near plane or the viewport
+// edges are shortened instead of dropped or handed whole to the rasterizer.
+// Vertices are classified once per batch; segments with both ends inside
+// reuse the projected points, segments with both ends outside the same plane
+// are rejected without any arithmetic.
+void clip_segments(
+	const ProjectedVertices & vertices,
+	const std::vector<LineSegment> & segments,
+	int width,
+	int height,
+	ClippedSegments & out
+);
+
+#endif
@@ -0,0 +1,180 @@
+#include <glm/glm.hpp>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PROJECTION_SSE2
+#endif
+
+#include "projection.hpp"
+
+VertexArraySoA::VertexArraySoA(const std::vector<glm::vec3> & vertices){
+	x.reserve(vertices.size());
+	y.reserve(vertices.size());
+	z.reserve(vertices.size());
+	for (const glm::vec3 & v : vertices)
+		push_back(v);
+}
+
+void VertexArraySoA::push_back(const glm::vec3 & v){
+	x.push_back(v.x);
+	y.push_back(v.y);
+	z.push_back(v.z);
+}
+
+void VertexArraySoA::clear(){
+	x.clear();
+	y.clear();
+	z.clear();
+}
+
+void ProjectedVertices::resize(size_t n){
+	if (x.size() < n){
+		x.resize(n);
+		y.resize(n);
+		w.resize(n);
+		cx.resize(n);
+		cy.resize(n);
+		cz.resize(n);
+		visible.resize(n);
+	}
+	count = n;
+}
+
+namespace {
+
+// Maps one clip space vertex. Operation order follows glm's mat4 * vec4 and the
+// original per vertex code, so all paths agree with the scalar results.
+inline void project_scalar(
+	const glm::mat4 & m, float x, float y, float z,
+	float width, float height, float half_w, float half_h,
+	float & out_x, float & out_y, float & out_w, unsigned char & out_visible,
+	float & out_cx, float & out_cy, float & out_cz
+){
+	const glm::vec4 c = (m[0] * x + m[1] * y) + (m[2] * z + m[3]);
+
+	out_cx = c.x;
+	out_cy = c.y;
+	out_cz = c.z;
+
+	out_x = c.x / c.w * width / 2 + half_w;
+	out_y = height - (c.y / c.w * height / 2 + half_h);
+	out_w = c.w;
+	out_visible = c.w > 0;
+}
+
+}
+
+void project_vertices(
+	const VertexArraySoA & in,
+	const glm::mat4 & m,
+	int width,
+	int height,
+	ProjectedVertices & out
+){
+	const size_t n = in.size();
+	out.resize(n);
+
+	const float * px = in.x.data();
+	const float * py = in.y.data();
+	const float * pz = in.z.data();
+	float * ox = out.x.data();
+	float * oy = out.y.data();
+	float * ow = out.w.data();
+	float * ocx = out.cx.data();
+	float * ocy = out.cy.data();
+	float * ocz = out.cz.data();
+	unsigned char * ov = out.visible.data();
+
+	const float fw = float(width);
+	const float fh = float(height);
+	// integer halves, as the viewport mapping always used them
+	const float half_w = float(width / 2);
+	const float half_h = float(height / 2);
+
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	const __m256 w_scale = _mm256_set1_ps(fw * 0.5f);
+	const __m256 h_scale = _mm256_set1_ps(fh * 0.5f);
+	const __m256 w_offset = _mm256_set1_ps(half_w);
+	const __m256 h_offset = _mm256_set1_ps(half_h);
+	const __m256 h_full = _mm256_set1_ps(fh);
+	const __m256 zero = _mm256_setzero_ps();
+
+	for (; i + 8 <= n; i += 8){
+		const __m256 vx = _mm256_loadu_ps(px + i);
+		const __m256 vy = _mm256_loadu_ps(py + i);
+		const __m256 vz = _mm256_loadu_ps(pz + i);
+
+		__m256 c[4];
+		for (int r = 0; r < 4; ++r){
+			const __m256 a = _mm256_add_ps(
+					_mm256_mul_ps(_mm256_set1_ps(m[0][r]), vx),
+					_mm256_mul_ps(_mm256_set1_ps(m[1][r]), vy));
+			const __m256 b = _mm256_add_ps(
+					_mm256_mul_ps(_mm256_set1_ps(m[2][r]), vz),
+					_mm256_set1_ps(m[3][r]));
+			c[r] = _mm256_add_ps(a, b);
+		}
+
+		const __m256 sx = _mm256_add_ps(_mm256_mul_ps(_mm256_div_ps(c[0], c[3]), w_scale), w_offset);
+		const __m256 sy = _mm256_sub_ps(h_full,
+				_mm256_add_ps(_mm256_mul_ps(_mm256_div_ps(c[1], c[3]), h_scale), h_offset));
+
+		_mm256_storeu_ps(ox + i, sx);
+		_mm256_storeu_ps(oy + i, sy);
+		_mm256_storeu_ps(ow + i, c[3]);
+		_mm256_storeu_ps(ocx + i, c[0]);
+		_mm256_storeu_ps(ocy + i, c[1]);
+		_mm256_storeu_ps(ocz + i, c[2]);
+
+		const int mask = _mm256_movemask_ps(_mm256_cmp_ps(c[3], zero, _CMP_GT_OQ));
+		for (int k = 0; k < 8; ++k)
+			ov[i + k] = (mask >> k) & 1;
+	}
+#elif defined(PROJECTION_SSE2)
+	const __m128 w_scale = _mm_set1_ps(fw * 0.5f);
+	const __m128 h_scale = _mm_set1_ps(fh * 0.5f);
+	const __m128 w_offset = _mm_set1_ps(half_w);
+	const __m128 h_offset = _mm_set1_ps(half_h);
+	const __m128 h_full = _mm_set1_ps(fh);
+	const __m128 zero = _mm_setzero_ps();
+
+	for (; i + 4 <= n; i += 4){
+		const __m128 vx = _mm_loadu_ps(px + i);
+		const __m128 vy = _mm_loadu_ps(py + i);
+		const __m128 vz = _mm_loadu_ps(pz + i);
+
+		__m128 c[4];
+		for (int r = 0; r < 4; ++r){
+			const __m128 a = _mm_add_ps(
+					_mm_mul_ps(_mm_set1_ps(m[0][r]), vx),
+					_mm_mul_ps(_mm_set1_ps(m[1][r]), vy));
+			const __m128 b = _mm_add_ps(
+					_mm_mul_ps(_mm_set1_ps(m[2][r]), vz),
+					_mm_set1_ps(m[3][r]));
+			c[r] = _mm_add_ps(a, b);
+		}
+
+		const __m128 sx = _mm_add_ps(_mm_mul_ps(_mm_div_ps(c[0], c[3]), w_scale), w_offset);
+		const __m128 sy = _mm_sub_ps(h_full,
+				_mm_add_ps(_mm_mul_ps(_mm_div_ps(c[1], c[3]), h_scale), h_offset));
+
+		_mm_storeu_ps(ox + i, sx);
+		_mm_storeu_ps(oy + i, sy);
+		_mm_storeu_ps(ow + i, c[3]);
+		_mm_storeu_ps(ocx + i, c[0]);
+		_mm_storeu_ps(ocy + i, c[1]);
+		_mm_storeu_ps(ocz + i, c[2]);
+
+		const int mask = _mm_movemask_ps(_mm_cmpgt_ps(c[3], zero));
+		for (int k = 0; k < 4; ++k)
+			ov[i + k] = (mask >> k) & 1;
+	}
+#endif
+
+	for (; i < n; ++i)
+		project_scalar(m, px[i], py[i], pz[i], fw, fh, half_w, half_h, ox[i], oy[i], ow[i], ov[i], ocx[i], ocy[i], ocz[i]);
+}
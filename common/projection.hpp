@@ -0,0 +1,53 @@
+#ifndef PROJECTION_HPP
+#define PROJECTION_HPP
+
+#include <vector>
+#include <glm/glm.hpp>
+
+// Model space vertices stored as separate coordinate arrays (SoA),
+// so the projection kernel can load several vertices per instruction.
+struct VertexArraySoA
+{
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+
+	VertexArraySoA(){}
+	VertexArraySoA(const std::vector<glm::vec3> & vertices);
+
+	void push_back(const glm::vec3 & v);
+	void clear();
+	size_t size() const { return x.size(); }
+};
+
+// Screen space output of project_vertices. Kept by the caller between frames:
+// resize() only grows the storage, so the steady state does not allocate.
+struct ProjectedVertices
+{
+	std::vector<float> x;       // pixels, origin at the top left corner
+	std::vector<float> y;
+	std::vector<float> w;       // clip space w, the view depth for a perspective projection
+	std::vector<float> cx;      // clip space x, y, z before the divide, for clipping
+	std::vector<float> cy;
+	std::vector<float> cz;
+	std::vector<unsigned char> visible; // 1 when the vertex is in front of the camera (w > 0)
+
+	void resize(size_t n);
+	size_t size() const { return count; }
+
+private:
+	size_t count = 0;
+};
+
+// Transforms every vertex by MVP, divides by w and maps the result to a
+// width x height viewport, the same way the cv::Mat draw paths did per vertex.
+// Uses AVX2 or SSE2 when the compiler targets them, scalar code otherwise.
+void project_vertices(
+	const VertexArraySoA & in,
+	const glm::mat4 & MVP,
+	int width,
+	int height,
+	ProjectedVertices & out
+);
+
+#endif
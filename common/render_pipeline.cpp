@@ -0,0 +1,193 @@
+#include <stdio.h>
+
+#include "render_pipeline.hpp"
+
+RenderPipeline::RenderPipeline(FramePool & frames_, ThreadPool * pool_, size_t depth, QueuePolicy policy_, Sink sink_,
+		StageTimers * timers_) :
+	frames(frames_),
+	pool(pool_),
+	policy(policy_),
+	sink(sink_),
+	timers(timers_),
+	free_rasters(depth),
+	recorded(depth),
+	rasterized(depth),
+	presented(depth),
+	stopping(false),
+	in_flight(0),
+	submitted(0),
+	skipped(0),
+	dropped(0),
+	displayed(0)
+{
+	if (timers){
+		raster_stage = timers->stage("raster");
+		display_stage = timers->stage("display");
+	}
+
+	for (size_t i = 0; i < depth; ++i){
+		rasterizers.emplace_back(new TileRasterizer(pool));
+		free_rasters.try_push(rasterizers.back().get());
+	}
+
+	raster_thread = std::thread(&RenderPipeline::raster_loop, this);
+	display_thread = std::thread(&RenderPipeline::display_loop, this);
+}
+
+RenderPipeline::~RenderPipeline()
+{
+	finish();
+}
+
+void RenderPipeline::finish()
+{
+	if (not raster_thread.joinable())
+		return;
+
+	// Let the frames already submitted drain through before stopping
+	SpinWait spin;
+	while (in_flight > 0)
+		spin.wait();
+
+	stopping = true;
+	raster_thread.join();
+	display_thread.join();
+}
+
+TileRasterizer * RenderPipeline::begin_frame(cv::Size size, const cv::Scalar & background_)
+{
+	TileRasterizer * raster = nullptr;
+
+	SpinWait spin;
+	while (not free_rasters.try_pop(raster)){
+		if (policy == QueuePolicy::DROP){
+			++skipped;
+			return nullptr;
+		}
+		spin.wait();
+	}
+
+	background = background_;
+	raster->begin_frame(size);
+	return raster;
+}
+
+void RenderPipeline::submit(TileRasterizer * raster, std::shared_ptr<const cv::Mat> base)
+{
+	Job job;
+	job.raster = raster;
+	job.background = background;
+	job.base = std::move(base);
+
+	// cannot be full: there are as many slots as rasterizers
+	++in_flight;
+	recorded.try_push(std::move(job));
+	++submitted;
+}
+
+void RenderPipeline::present(FramePool::Frame && frame)
+{
+	++in_flight;
+
+	SpinWait spin;
+	while (not presented.try_push(std::move(frame))){
+		if (policy == QueuePolicy::DROP){
+			++dropped;
+			frame.release();
+			--in_flight;
+			return;
+		}
+		spin.wait();
+	}
+}
+
+void RenderPipeline::raster_loop()
+{
+	SpinWait spin;
+	Job job;
+
+	while (not stopping){
+		if (not recorded.try_pop(job)){
+			spin.wait();
+			continue;
+		}
+		spin.reset();
+
+		FramePool::Frame frame = frames.acquire();
+		{
+			ScopedStageTimer timer(timers, raster_stage);
+			if (job.base)
+				job.base->copyTo(frame.mat);
+			else
+				frame.mat.setTo(job.background);
+			job.raster->rasterize(frame.mat);
+		}
+		// the base may be reused by its owner once no job holds it
+		job.base.reset();
+
+		// the rasterizer is free again; its queue has a slot for every rasterizer
+		free_rasters.try_push(std::move(job.raster));
+
+		SpinWait push_spin;
+		while (not rasterized.try_push(std::move(frame))){
+			if (policy == QueuePolicy::DROP){
+				++dropped;
+				frame.release();
+				--in_flight;
+				break;
+			}
+			push_spin.wait();
+		}
+	}
+}
+
+void RenderPipeline::display_loop()
+{
+	SpinWait spin;
+	FramePool::Frame frame;
+
+	while (not stopping){
+		bool idle = true;
+
+		if (rasterized.try_pop(frame)){
+			ScopedStageTimer timer(timers, display_stage);
+			sink(frame.mat, SOFTWARE);
+			frame.release();
+			++displayed;
+			--in_flight;
+			idle = false;
+		}
+
+		if (presented.try_pop(frame)){
+			ScopedStageTimer timer(timers, display_stage);
+			sink(frame.mat, READBACK);
+			frame.release();
+			++displayed;
+			--in_flight;
+			idle = false;
+		}
+
+		if (idle)
+			spin.wait();
+		else
+			spin.reset();
+	}
+}
+
+RenderPipeline::Stats RenderPipeline::stats() const
+{
+	Stats s;
+	s.submitted = submitted;
+	s.skipped = skipped;
+	s.dropped = dropped;
+	s.displayed = displayed;
+	return s;
+}
+
+void RenderPipeline::print_stats(const char * name) const
+{
+	const Stats s = stats();
+	printf("%s: %s, submitted %lu, skipped %lu, dropped %lu, displayed %lu\n",
+			name, policy == QueuePolicy::DROP ? "drop" : "block",
+			s.submitted, s.skipped, s.dropped, s.displayed);
+}
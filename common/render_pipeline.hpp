@@ -0,0 +1,111 @@
+#ifndef RENDER_PIPELINE_HPP
+#define RENDER_PIPELINE_HPP
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "frame_pool.hpp"
+#include "spsc_queue.hpp"
+#include "stage_timers.hpp"
+#include "tile_rasterizer.hpp"
+
+class ThreadPool;
+
+// What a stage does when the next stage's queue is full
+enum class QueuePolicy { BLOCK, DROP };
+
+// Software rendering and display stages running behind the GL thread.
+//
+//   caller (simulation, GL submission, primitive recording)
+//     -> raster thread (TileRasterizer::rasterize into a pooled frame)
+//     -> display thread (sink, e.g. cv::imshow + cv::waitKey)
+//
+// Stages talk through bounded SpscQueues only. With QueuePolicy::DROP a slow
+// stage loses frames instead of stalling the stages before it.
+class RenderPipeline
+{
+public:
+	enum Channel { SOFTWARE, READBACK };
+
+	// Called on the display thread for every frame that made it through
+	typedef std::function<void(const cv::Mat & frame, Channel channel)> Sink;
+
+	struct Stats
+	{
+		unsigned long submitted;     // frames recorded by the caller
+		unsigned long skipped;       // frames not recorded, no free rasterizer (DROP)
+		unsigned long dropped;       // frames rasterized but not displayed (DROP)
+		unsigned long displayed;     // frames handed to the sink
+	};
+
+	// depth is the number of frames that can be in flight per stage.
+	// With timers, the raster and display stages record into "raster" and "display".
+	RenderPipeline(FramePool & frames, ThreadPool * pool, size_t depth, QueuePolicy policy, Sink sink,
+			StageTimers * timers = nullptr);
+	~RenderPipeline();
+
+	RenderPipeline(const RenderPipeline &) = delete;
+	RenderPipeline & operator=(const RenderPipeline &) = delete;
+
+	// Returns a rasterizer to record the next software frame into, or nullptr
+	// if every rasterizer is still in flight and the policy is DROP.
+	TileRasterizer * begin_frame(cv::Size size, const cv::Scalar & background);
+	// Hands a frame recorded into the rasterizer from begin_frame to the raster stage.
+	// With base (e.g. a StaticLayer image) the frame starts as a copy of it
+	// instead of the background; base must have the frame's size and type.
+	void submit(TileRasterizer * raster, std::shared_ptr<const cv::Mat> base = nullptr);
+
+	// Hands an already finished frame (e.g. a GL readback) straight to the display stage
+	void present(FramePool::Frame && frame);
+
+	// Lets the frames in flight drain through the sink, then stops the stage
+	// threads; nothing may be submitted afterwards. The destructor calls it.
+	void finish();
+
+	Stats stats() const;
+	void print_stats(const char * name) const;
+
+private:
+	struct Job
+	{
+		TileRasterizer * raster = nullptr;
+		cv::Scalar background;
+		std::shared_ptr<const cv::Mat> base;
+	};
+
+	void raster_loop();
+	void display_loop();
+
+	FramePool & frames;
+	ThreadPool * pool;
+	const QueuePolicy policy;
+	Sink sink;
+
+	StageTimers * timers;
+	int raster_stage = -1;
+	int display_stage = -1;
+
+	std::vector<std::unique_ptr<TileRasterizer>> rasterizers;
+	cv::Scalar background;
+
+	SpscQueue<TileRasterizer *> free_rasters;  // raster thread -> caller
+	SpscQueue<Job> recorded;                   // caller -> raster thread
+	SpscQueue<FramePool::Frame> rasterized;    // raster thread -> display thread
+	SpscQueue<FramePool::Frame> presented;     // caller -> display thread
+
+	std::atomic<bool> stopping;
+	std::atomic<int> in_flight;  // frames submitted or presented and not yet displayed or dropped
+	std::atomic<unsigned long> submitted;
+	std::atomic<unsigned long> skipped;
+	std::atomic<unsigned long> dropped;
+	std::atomic<unsigned long> displayed;
+
+	std::thread raster_thread;
+	std::thread display_thread;
+};
+
+#endif
@@ -0,0 +1,121 @@
+#include <stdio.h>
+
+#include "gl_state.hpp"
+#include "render_queue.hpp"
+
+namespace {
+
+// bytes of the key make_key fills, one radix pass each
+const int KEY_BYTES = 5;
+
+}
+
+DrawPacket RenderQueue::packet(GLuint program, GLuint vao, GLenum mode, GLenum polygon_mode, bool depth_test,
+		GLint first, GLsizei count)
+{
+	DrawPacket p;
+	p.program = program;
+	p.vao = vao;
+	p.mode = mode;
+	p.polygon_mode = polygon_mode;
+	p.depth_test = depth_test;
+	p.first = first;
+	p.count = count;
+	p.instances = 0;
+	p.int_location = -1;
+	p.int_value = 0;
+	for (int i = 0; i < 2; ++i){
+		p.vec4_locations[i] = -1;
+		p.vec4_values[i] = glm::vec4(0, 0, 0, 0);
+	}
+	return p;
+}
+
+uint64_t RenderQueue::make_key(const DrawPacket & p)
+{
+	// most expensive change in the highest bits; GL names are small integers,
+	// and two names sharing their low bits only cost a missed grouping
+	return uint64_t(p.depth_test ? 0 : 1) << 37
+			| uint64_t(p.program & 0xffff) << 21
+			| uint64_t(p.polygon_mode == GL_FILL ? 1 : 0) << 20
+			| uint64_t(p.mode & 0xf) << 16
+			| uint64_t(p.vao & 0xffff);
+}
+
+void RenderQueue::submit(const DrawPacket & packet)
+{
+	items.push_back(SortItem{make_key(packet), uint32_t(packets.size())});
+	packets.push_back(packet);
+}
+
+void RenderQueue::sort()
+{
+	const size_t n = items.size();
+	scratch.resize(n);
+
+	// all histograms in one read of the keys
+	size_t counts[KEY_BYTES][256] = {};
+	for (const SortItem & item : items)
+		for (int b = 0; b < KEY_BYTES; ++b)
+			++counts[b][(item.key >> (8 * b)) & 0xff];
+
+	for (int b = 0; b < KEY_BYTES; ++b){
+		size_t * count = counts[b];
+
+		// every key has the same byte here: the pass would not move anything
+		if (count[(items[0].key >> (8 * b)) & 0xff] == n)
+			continue;
+
+		size_t offset = 0;
+		for (int d = 0; d < 256; ++d){
+			const size_t c = count[d];
+			count[d] = offset;
+			offset += c;
+		}
+
+		for (const SortItem & item : items)
+			scratch[count[(item.key >> (8 * b)) & 0xff]++] = item;
+		items.swap(scratch);
+	}
+}
+
+void RenderQueue::execute()
+{
+	if (packets.empty())
+		return;
+
+	sort();
+
+	// the state cache skips whatever the previous packet already set
+	GlState & state = gl_state();
+	for (const SortItem & item : items){
+		const DrawPacket & p = packets[item.index];
+
+		state.use_program(p.program);
+		state.bind_vertex_array(p.vao);
+		state.polygon_mode(p.polygon_mode);
+		state.set_enabled(GL_DEPTH_TEST, p.depth_test);
+
+		if (p.int_location >= 0)
+			glUniform1i(p.int_location, p.int_value);
+		for (int i = 0; i < 2; ++i)
+			if (p.vec4_locations[i] >= 0)
+				glUniform4fv(p.vec4_locations[i], 1, &p.vec4_values[i][0]);
+
+		if (p.instances > 0)
+			glDrawArraysInstanced(p.mode, p.first, p.count, p.instances);
+		else
+			glDrawArrays(p.mode, p.first, p.count);
+	}
+
+	++frames;
+	drawn += packets.size();
+	packets.clear();
+	items.clear();
+}
+
+void RenderQueue::print_stats(const char * name) const
+{
+	const double n = frames > 0 ? double(frames) : 1.0;
+	printf("%s: %.1f packets per frame\n", name, drawn / n);
+}
@@ -0,0 +1,72 @@
+#ifndef RENDER_QUEUE_HPP
+#define RENDER_QUEUE_HPP
+
+#include <stdint.h>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// One GL draw call together with the state it needs
+struct DrawPacket
+{
+	// state; packets sharing it are drawn one after another
+	GLuint program;
+	GLuint vao;
+	GLenum mode;            // primitive type: GL_LINES, GL_TRIANGLES, ...
+	GLenum polygon_mode;    // GL_LINE or GL_FILL
+	bool depth_test;
+
+	// glDrawArrays(mode, first, count), instanced when instances > 0
+	GLint first;
+	GLsizei count;
+	GLsizei instances;
+
+	// per draw uniforms of program, set when location >= 0
+	GLint int_location;
+	GLint int_value;
+	GLint vec4_locations[2];
+	glm::vec4 vec4_values[2];
+};
+
+// Draw packets of one frame. Drawables submit them in any order; execute()
+// sorts them by a key built from the depth state, program, polygon mode,
+// primitive and vertex array, then issues them through gl_state(), so a
+// piece of state is only changed where it differs from the previous packet's.
+// The sort is a stable radix sort, so packets with equal keys keep their
+// submission order.
+class RenderQueue
+{
+public:
+	// Packet with all state fields set and no uniforms, to be completed by the caller
+	static DrawPacket packet(GLuint program, GLuint vao, GLenum mode, GLenum polygon_mode, bool depth_test,
+			GLint first, GLsizei count);
+
+	void submit(const DrawPacket & packet);
+
+	// Sorts and draws every submitted packet, then empties the queue.
+	// The state the last packet set stays bound.
+	void execute();
+
+	size_t size() const { return packets.size(); }
+	void print_stats(const char * name) const;
+
+private:
+	struct SortItem
+	{
+		uint64_t key;
+		uint32_t index;
+	};
+
+	static uint64_t make_key(const DrawPacket & packet);
+	void sort();
+
+	std::vector<DrawPacket> packets;
+	std::vector<SortItem> items;
+	std::vector<SortItem> scratch;
+
+	unsigned long frames = 0;
+	unsigned long drawn = 0;
+};
+
+#endif
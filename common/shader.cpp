@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <string>
 #include <vector>
+#include <map>
 #include <iostream>
 #include <fstream>
 #include <algorithm>
@@ -14,40 +15,110 @@ using namespace std;
 
 #include "shader.hpp"
 
-GLuint LoadShaders(const char * vertex_file_path, const char * fragment_file_path){
+namespace {
 
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+struct CachedProgram
+{
+	GLuint programID;
+	int references;
+};
 
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-
-	if(VertexShaderStream.is_open()){
-		std::stringstream sstr;
-		sstr << VertexShaderStream.rdbuf();
-		VertexShaderCode = sstr.str();
-		VertexShaderStream.close();
-	}else{
-		printf(
-				"Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n",
-				vertex_file_path
-				);
+// Programs already built in this process, keyed by source paths and content hash
+std::map<std::string, CachedProgram> program_cache;
+
+std::string binary_cache_dir = ".";
+
+bool ReadFile(const char * path, std::string & out){
+	std::ifstream stream(path, std::ios::in | std::ios::binary);
+	if (!stream.is_open())
+		return false;
+
+	std::stringstream sstr;
+	sstr << stream.rdbuf();
+	out = sstr.str();
+	return true;
+}
+
+// 64-bit FNV-1a
+unsigned long long HashBytes(const std::string & data, unsigned long long hash = 14695981039346656037ULL){
+	for (unsigned char c : data){
+		hash ^= c;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+std::string GLString(GLenum name){
+	const GLubyte * str = glGetString(name);
+	return str ? (const char *)str : "";
+}
+
+bool BinaryCacheSupported(){
+	return GLEW_ARB_get_program_binary;
+}
+
+std::string BinaryCachePath(unsigned long long hash){
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.glprogram", hash);
+	return binary_cache_dir + name;
+}
+
+bool IsLinked(GLuint ProgramID){
+	GLint Result = GL_FALSE;
+	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+	return Result == GL_TRUE;
+}
 
-		getchar();
+// Returns 0 when there is no usable binary for this hash (missing, truncated,
+// or rejected by a driver that changed since it was written)
+GLuint LoadProgramBinary(unsigned long long hash){
+	std::string blob;
+	if (!ReadFile(BinaryCachePath(hash).c_str(), blob) || blob.size() <= sizeof(GLenum))
+		return 0;
+
+	GLenum format;
+	memcpy(&format, blob.data(), sizeof(format));
+
+	GLuint ProgramID = glCreateProgram();
+	glProgramBinary(ProgramID, format, blob.data() + sizeof(format), GLsizei(blob.size() - sizeof(format)));
+
+	if (!IsLinked(ProgramID)){
+		glDeleteProgram(ProgramID);
 		return 0;
 	}
 
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
-		std::stringstream sstr;
-		sstr << FragmentShaderStream.rdbuf();
-		FragmentShaderCode = sstr.str();
-		FragmentShaderStream.close();
+	return ProgramID;
+}
+
+void SaveProgramBinary(GLuint ProgramID, unsigned long long hash){
+	GLint length = 0;
+	glGetProgramiv(ProgramID, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	std::vector<char> blob(sizeof(GLenum) + length);
+	GLenum format = 0;
+	glGetProgramBinary(ProgramID, length, NULL, &format, &blob[sizeof(GLenum)]);
+	memcpy(&blob[0], &format, sizeof(format));
+
+	const std::string path = BinaryCachePath(hash);
+	std::ofstream stream(path.c_str(), std::ios::out | std::ios::binary);
+	if (!stream.is_open()){
+		printf("Impossible to write program binary %s\n", path.c_str());
+		return;
 	}
+	stream.write(&blob[0], blob.size());
+}
+
+GLuint CompileProgram(
+	const char * vertex_file_path, const std::string & VertexShaderCode,
+	const char * fragment_file_path, const std::string & FragmentShaderCode,
+	bool retrievable
+){
+
+	// Create the shaders
+	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
 
 	GLint Result = GL_FALSE;
 	int InfoLogLength;
@@ -88,6 +159,8 @@ GLuint LoadShaders(const char * vertex_file_path, const char * fragment_file_pat
 	GLuint ProgramID = glCreateProgram();
 	glAttachShader(ProgramID, VertexShaderID);
 	glAttachShader(ProgramID, FragmentShaderID);
+	if (retrievable)
+		glProgramParameteri(ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(ProgramID);
 
 	// Check the program
@@ -108,4 +181,90 @@ GLuint LoadShaders(const char * vertex_file_path, const char * fragment_file_pat
 	return ProgramID;
 }
 
+}
+
+void SetShaderCacheDirectory(const char * path){
+	binary_cache_dir = path;
+}
+
+GLuint LoadShaders(const char * vertex_file_path, const char * fragment_file_path){
+
+	// Read the Vertex Shader code from the file
+	std::string VertexShaderCode;
+	if (!ReadFile(vertex_file_path, VertexShaderCode)){
+		printf(
+				"Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n",
+				vertex_file_path
+				);
+		return 0;
+	}
+
+	// Read the Fragment Shader code from the file
+	std::string FragmentShaderCode;
+	if (!ReadFile(fragment_file_path, FragmentShaderCode)){
+		printf(
+				"Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n",
+				fragment_file_path
+				);
+		return 0;
+	}
+
+	const unsigned long long sources_hash = HashBytes(FragmentShaderCode, HashBytes(VertexShaderCode));
+
+	std::string key = vertex_file_path;
+	key += '\n';
+	key += fragment_file_path;
+	key += '\n';
+	key += std::to_string(sources_hash);
+
+	auto cached = program_cache.find(key);
+	if (cached != program_cache.end()){
+		++cached->second.references;
+		return cached->second.programID;
+	}
+
+	// Binaries are only valid for the driver that produced them
+	const unsigned long long binary_hash = HashBytes(
+			GLString(GL_VENDOR) + GLString(GL_RENDERER) + GLString(GL_VERSION),
+			HashBytes(key));
+
+	const bool use_binary = BinaryCacheSupported();
+
+	GLuint ProgramID = 0;
+	if (use_binary){
+		ProgramID = LoadProgramBinary(binary_hash);
+		if (ProgramID)
+			printf("Loaded program binary : %s\n", BinaryCachePath(binary_hash).c_str());
+	}
+
+	if (!ProgramID){
+		ProgramID = CompileProgram(
+				vertex_file_path, VertexShaderCode,
+				fragment_file_path, FragmentShaderCode,
+				use_binary);
+
+		if (use_binary && IsLinked(ProgramID))
+			SaveProgramBinary(ProgramID, binary_hash);
+	}
+
+	program_cache[key] = CachedProgram{ProgramID, 1};
+
+	return ProgramID;
+}
+
+void ReleaseShaders(GLuint programID){
+	for (auto it = program_cache.begin(); it != program_cache.end(); ++it){
+		if (it->second.programID != programID)
+			continue;
+
+		if (--it->second.references == 0){
+			glDeleteProgram(programID);
+			program_cache.erase(it);
+		}
+		return;
+	}
+
+	// not from LoadShaders
+	glDeleteProgram(programID);
+}
 
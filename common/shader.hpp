@@ -1,6 +1,16 @@
 #ifndef SHADER_HPP
 #define SHADER_HPP
 
+// Compiles and links a program from two shader files, or returns 0 if one of them cannot be read.
+// Each pair of files (and their content) is built once per process: later calls return the same
+// program. Linked programs are also kept as binaries in the shader cache directory, so the next
+// start skips compilation when the driver supports it.
 GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path);
 
+// Releases a program returned by LoadShaders; it is deleted once every user released it.
+void ReleaseShaders(GLuint programID);
+
+// Where program binaries are read from and written to. Defaults to the working directory.
+void SetShaderCacheDirectory(const char * path);
+
 #endif
@@ -0,0 +1,39 @@
+#include "sim_clock.hpp"
+
+SimClock::SimClock(Mode mode_, double param_) :
+	mode(mode_),
+	param(param_),
+	last(std::chrono::steady_clock::now())
+{
+}
+
+SimClock SimClock::wall_clock(){
+	return SimClock(WALL_CLOCK, 1.0);
+}
+
+SimClock SimClock::scaled(double factor){
+	return SimClock(SCALED, factor);
+}
+
+SimClock SimClock::fixed_step(double step){
+	return SimClock(FIXED_STEP, step);
+}
+
+void SimClock::tick(){
+	// The first tick stays at t = 0 so every mode starts from the same state
+	if (frames++ == 0){
+		last = std::chrono::steady_clock::now();
+		dt = 0;
+		return;
+	}
+
+	if (mode == FIXED_STEP){
+		dt = param;
+	} else {
+		const auto current = std::chrono::steady_clock::now();
+		dt = std::chrono::duration<double>(current - last).count() * param;
+		last = current;
+	}
+
+	time += dt;
+}
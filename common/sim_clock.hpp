@@ -0,0 +1,43 @@
+#ifndef SIM_CLOCK_HPP
+#define SIM_CLOCK_HPP
+
+#include <chrono>
+
+// Simulation time source handed to every Drawable::update.
+// WALL_CLOCK follows real time, SCALED follows real time multiplied by a factor,
+// FIXED_STEP advances by a constant step per tick regardless of how long a frame took,
+// so two runs with the same step produce identical frames.
+class SimClock
+{
+public:
+	enum Mode { WALL_CLOCK, SCALED, FIXED_STEP };
+
+	static SimClock wall_clock();
+	static SimClock scaled(double factor);
+	static SimClock fixed_step(double step);
+
+	// Advance to the next frame. Call once per frame, before updating the objects.
+	void tick();
+
+	// Simulation time in seconds, starting at 0
+	double now() const { return time; }
+	// Simulation time elapsed during the last tick
+	double delta() const { return dt; }
+	unsigned long frame() const { return frames; }
+
+	Mode get_mode() const { return mode; }
+
+private:
+	SimClock(Mode mode_, double param_);
+
+	Mode mode;
+	double param; // scale factor or fixed step
+
+	double time = 0;
+	double dt = 0;
+	unsigned long frames = 0;
+
+	std::chrono::steady_clock::time_point last;
+};
+
+#endif
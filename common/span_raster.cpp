@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SPAN_RASTER_SSE2
+#endif
+
+#include "span_raster.hpp"
+
+namespace {
+
+// Widens every primitive by this many pixels, so a pixel center exactly on the
+// border is covered whatever the rounding of the row arithmetic
+const double EDGE_EPSILON = 1.0 / 64;
+
+unsigned char channel(double v)
+{
+	return (unsigned char)(std::min(255.0, std::max(0.0, floor(v + 0.5))));
+}
+
+// The first bytes bytes of a pattern, bytes < 96, as two fixed size copies
+// that overlap in the middle: the pattern is periodic, so the second copy
+// writes the same bytes as the first where they meet. Short spans are the
+// common case and a variable length memcpy costs more than the span.
+inline void copy_pattern(unsigned char * p, const unsigned char * pattern, int bytes)
+{
+	if (bytes >= 64){
+		memcpy(p, pattern, 64);
+		memcpy(p + bytes - 32, pattern + bytes - 32, 32);
+	} else if (bytes >= 32){
+		memcpy(p, pattern, 32);
+		memcpy(p + bytes - 32, pattern + bytes - 32, 32);
+	} else if (bytes >= 16){
+		memcpy(p, pattern, 16);
+		memcpy(p + bytes - 16, pattern + bytes - 16, 16);
+	} else if (bytes >= 8){
+		memcpy(p, pattern, 8);
+		memcpy(p + bytes - 8, pattern + bytes - 8, 8);
+	} else if (bytes >= 4){
+		memcpy(p, pattern, 4);
+		memcpy(p + bytes - 4, pattern + bytes - 4, 4);
+	} else if (bytes >= 2){
+		memcpy(p, pattern, 2);
+		memcpy(p + bytes - 2, pattern + bytes - 2, 2);
+	}
+}
+
+// Narrows [l, h] to the x with lo <= c * x + e <= hi; inverse is 1 / c
+inline void narrow(double c, double inverse, double e, double lo, double hi, double & l, double & h)
+{
+	if (c == 0){
+		if (e < lo or e > hi){
+			l = 1;
+			h = 0;
+		}
+		return;
+	}
+
+	double t1 = (lo - e) * inverse;
+	double t2 = (hi - e) * inverse;
+	if (c < 0)
+		std::swap(t1, t2);
+	l = std::max(l, t1);
+	h = std::min(h, t2);
+}
+
+// Widens [l, h] by the row's chord of the disc of radius r around (cx, cy)
+inline void cap(double cx, double cy, double r, double y, double & l, double & h)
+{
+	const double e = y - cy;
+	if (e * e > r * r)
+		return;
+	const double half = sqrt(r * r - e * e);
+	l = std::min(l, cx - half);
+	h = std::max(h, cx + half);
+}
+
+}
+
+SpanColor::SpanColor(const cv::Scalar & bgr)
+{
+	const unsigned char c[3] = {channel(bgr[0]), channel(bgr[1]), channel(bgr[2])};
+	for (int i = 0; i < PIXELS; ++i)
+		memcpy(pattern + 3 * i, c, 3);
+}
+
+void fill_span(unsigned char * row, int x0, int x1, const SpanColor & color)
+{
+	unsigned char * p = row + 3 * x0;
+	int n = x1 - x0;
+
+	// the pattern starts on a pixel, so every block written from its start lines up
+#if defined(__AVX2__)
+	if (n >= 32){
+		const __m256i c0 = _mm256_load_si256((const __m256i *)color.pattern);
+		const __m256i c1 = _mm256_load_si256((const __m256i *)(color.pattern + 32));
+		const __m256i c2 = _mm256_load_si256((const __m256i *)(color.pattern + 64));
+		for (; n >= 32; n -= 32, p += 96){
+			_mm256_storeu_si256((__m256i *)p, c0);
+			_mm256_storeu_si256((__m256i *)(p + 32), c1);
+			_mm256_storeu_si256((__m256i *)(p + 64), c2);
+		}
+	}
+#elif defined(SPAN_RASTER_SSE2)
+	if (n >= 16){
+		const __m128i c0 = _mm_load_si128((const __m128i *)color.pattern);
+		const __m128i c1 = _mm_load_si128((const __m128i *)(color.pattern + 16));
+		const __m128i c2 = _mm_load_si128((const __m128i *)(color.pattern + 32));
+		for (; n >= 16; n -= 16, p += 48){
+			_mm_storeu_si128((__m128i *)p, c0);
+			_mm_storeu_si128((__m128i *)(p + 16), c1);
+			_mm_storeu_si128((__m128i *)(p + 32), c2);
+		}
+	}
+#endif
+	for (; n >= SpanColor::PIXELS; n -= SpanColor::PIXELS, p += 3 * SpanColor::PIXELS)
+		memcpy(p, color.pattern, 3 * SpanColor::PIXELS);
+	copy_pattern(p, color.pattern, 3 * n);
+}
+
+bool span_segment(float x1, float y1, float x2, float y2, cv::Size size, int thickness, SpanSegment & segment)
+{
+	// Liang-Barsky against the frame grown by the half thickness and a pixel
+	const double margin = 0.5 * thickness + 1;
+	const double dx = double(x2) - x1;
+	const double dy = double(y2) - y1;
+	const double p[4] = {-dx, dx, -dy, dy};
+	const double q[4] = {
+		x1 + margin,
+		size.width - 1 + margin - x1,
+		y1 + margin,
+		size.height - 1 + margin - y1,
+	};
+
+	double t0 = 0;
+	double t1 = 1;
+	for (int i = 0; i < 4; ++i){
+		if (p[i] == 0){
+			if (q[i] < 0)
+				return false;
+			continue;
+		}
+		const double t = q[i] / p[i];
+		if (p[i] < 0)
+			t0 = std::max(t0, t);
+		else
+			t1 = std::min(t1, t);
+		if (t0 > t1)
+			return false;
+	}
+
+	segment.x1 = int(lround((x1 + t0 * dx) * SPAN_ONE));
+	segment.y1 = int(lround((y1 + t0 * dy) * SPAN_ONE));
+	segment.x2 = int(lround((x1 + t1 * dx) * SPAN_ONE));
+	segment.y2 = int(lround((y1 + t1 * dy) * SPAN_ONE));
+	return true;
+}
+
+void span_line(cv::Mat & frame, const cv::Rect & clip, const SpanSegment & segment, int thickness,
+		const SpanColor & color)
+{
+	const double ax = double(segment.x1) / SPAN_ONE;
+	const double ay = double(segment.y1) / SPAN_ONE;
+	const double bx = double(segment.x2) / SPAN_ONE;
+	const double by = double(segment.y2) / SPAN_ONE;
+
+	const double r = 0.5 * thickness + EDGE_EPSILON;
+	const double dx = bx - ax;
+	const double dy = by - ay;
+	const double length2 = dx * dx + dy * dy;
+	const double rl = r * sqrt(length2);
+	// of the x coefficients in the body's constraints, zero for the one that
+	// does not depend on x
+	const double inverse_dx = dx != 0 ? 1 / dx : 0;
+	const double inverse_dy = dy != 0 ? -1 / dy : 0;
+
+	const int y0 = std::max(int(ceil(std::min(ay, by) - r)), clip.y);
+	const int y1 = std::min(int(floor(std::max(ay, by) + r)), clip.y + clip.height - 1);
+	const double left = clip.x;
+	const double right = clip.x + clip.width - 1;
+
+	for (int y = y0; y <= y1; ++y){
+		double l = HUGE_VAL;
+		double h = -HUGE_VAL;
+
+		// the round caps
+		cap(ax, ay, r, y, l, h);
+		cap(bx, by, r, y, l, h);
+
+		// the body, relative to ax: within r of the line through a and b,
+		// between the perpendiculars through a and b
+		if (length2 > 0){
+			double bl = -HUGE_VAL;
+			double bh = HUGE_VAL;
+			narrow(-dy, inverse_dy, dx * (y - ay), -rl, rl, bl, bh);
+			narrow(dx, inverse_dx, dy * (y - ay), 0, length2, bl, bh);
+			if (bl <= bh){
+				l = std::min(l, bl + ax);
+				h = std::max(h, bh + ax);
+			}
+		}
+
+		// the caps and the body are convex pieces of one convex shape, so
+		// their row intervals overlap and the hull of them is the row's span
+		if (l > h)
+			continue;
+		const int x0 = int(ceil(std::min(std::max(l, left), right + 1)));
+		const int x1 = int(floor(std::max(std::min(h, right), left - 1))) + 1;
+		if (x0 < x1)
+			fill_span(frame.ptr<unsigned char>(y), x0, x1, color);
+	}
+}
+
+void span_disc(cv::Mat & frame, const cv::Rect & clip, cv::Point center, int radius, const SpanColor & color)
+{
+	const int y0 = std::max(center.y - radius, clip.y);
+	const int y1 = std::min(center.y + radius, clip.y + clip.height - 1);
+
+	for (int y = y0; y <= y1; ++y){
+		const int e = y - center.y;
+		// exact for the small integers involved
+		const int half = int(sqrtf(float(radius * radius - e * e)));
+		const int x0 = std::max(center.x - half, clip.x);
+		const int x1 = std::min(center.x + half + 1, clip.x + clip.width);
+		if (x0 < x1)
+			fill_span(frame.ptr<unsigned char>(y), x0, x1, color);
+	}
+}
@@ -0,0 +1,54 @@
+#ifndef SPAN_RASTER_HPP
+#define SPAN_RASTER_HPP
+
+#include <opencv2/opencv.hpp>
+
+// Rasterizer for the two primitives the software path draws: thick lines and
+// filled vertex markers, written row span by row span into packed BGR
+// (CV_8UC3) frames. Unlike cv::line it does no per call type dispatch and
+// clips each row against a rectangle instead of the whole line.
+//
+// Pixel (x, y) is centered on the point (x, y), as in cv::line. A pixel is
+// covered from its center alone, so drawing a primitive clipped tile by tile
+// writes exactly the pixels drawing it whole would.
+
+// Fractional bits of SpanSegment end points
+const int SPAN_SHIFT = 4;
+const int SPAN_ONE = 1 << SPAN_SHIFT;
+
+// Line end points in 1 / SPAN_ONE pixels
+struct SpanSegment
+{
+	int x1;
+	int y1;
+	int x2;
+	int y2;
+};
+
+// A color repeated over enough pixels to fill spans with whole vector stores
+struct SpanColor
+{
+	static const int PIXELS = 32;
+
+	explicit SpanColor(const cv::Scalar & bgr);
+
+	alignas(32) unsigned char pattern[3 * PIXELS];
+};
+
+// Fixed point segment from pixel end points. Clips the segment to the frame
+// grown by the line's half thickness first, so far away end points neither
+// overflow nor cost rows that are never drawn. False when nothing is left.
+bool span_segment(float x1, float y1, float x2, float y2, cv::Size size, int thickness, SpanSegment & segment);
+
+// Pixels whose center is within thickness / 2 of the segment: round capped
+// like cv::line with the same thickness. Only pixels inside clip are written.
+void span_line(cv::Mat & frame, const cv::Rect & clip, const SpanSegment & segment, int thickness,
+		const SpanColor & color);
+
+// Pixels within radius of center, only inside clip
+void span_disc(cv::Mat & frame, const cv::Rect & clip, cv::Point center, int radius, const SpanColor & color);
+
+// Pixels [x0, x1) of one CV_8UC3 row
+void fill_span(unsigned char * row, int x0, int x1, const SpanColor & color);
+
+#endif
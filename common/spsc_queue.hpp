@@ -0,0 +1,80 @@
+#ifndef SPSC_QUEUE_HPP
+#define SPSC_QUEUE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread.
+// T must be default constructible and movable.
+template<class T>
+class SpscQueue
+{
+public:
+	explicit SpscQueue(size_t capacity) : slots(capacity + 1), head(0), tail(0) {}
+
+	SpscQueue(const SpscQueue &) = delete;
+	SpscQueue & operator=(const SpscQueue &) = delete;
+
+	// Producer only. Moves from value on success, leaves it untouched when full.
+	bool try_push(T && value)
+	{
+		const size_t t = tail.load(std::memory_order_relaxed);
+		const size_t next = advance(t);
+		if (next == head.load(std::memory_order_acquire))
+			return false;
+
+		slots[t] = std::move(value);
+		tail.store(next, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer only
+	bool try_pop(T & out)
+	{
+		const size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire))
+			return false;
+
+		out = std::move(slots[h]);
+		slots[h] = T();
+		head.store(advance(h), std::memory_order_release);
+		return true;
+	}
+
+	bool empty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+	size_t capacity() const { return slots.size() - 1; }
+
+private:
+	size_t advance(size_t i) const { return i + 1 == slots.size() ? 0 : i + 1; }
+
+	std::vector<T> slots;
+
+	// producer and consumer indices on separate cache lines
+	std::atomic<size_t> head;
+	char padding[64 - sizeof(std::atomic<size_t>)];
+	std::atomic<size_t> tail;
+};
+
+// Backoff for threads waiting on a SpscQueue: spins briefly, then yields, then sleeps
+class SpinWait
+{
+public:
+	void wait()
+	{
+		if (++spins < 64)
+			return;
+		if (spins < 128)
+			std::this_thread::yield();
+		else
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+	}
+
+	void reset() { spins = 0; }
+
+private:
+	unsigned spins = 0;
+};
+
+#endif
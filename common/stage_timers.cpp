@@ -0,0 +1,155 @@
+#include <algorithm>
+
+#include "stage_timers.hpp"
+
+namespace {
+
+// Values below 8 ns get a bucket each; above, every power of two is split in 8
+const int sub_buckets = 8;
+const int bucket_count = 62 * sub_buckets;
+
+int highest_bit(unsigned long long v){
+#if defined(__GNUC__)
+	return 63 - __builtin_clzll(v);
+#else
+	int bit = 0;
+	while (v >>= 1)
+		++bit;
+	return bit;
+#endif
+}
+
+int bucket_of(unsigned long long ns){
+	if (ns < sub_buckets)
+		return int(ns);
+
+	const int e = highest_bit(ns);
+	const int sub = int(ns >> (e - 3)) & (sub_buckets - 1);
+	return (e - 2) * sub_buckets + sub;
+}
+
+// Largest value that falls into the bucket
+unsigned long long bucket_upper(int bucket){
+	if (bucket < sub_buckets)
+		return bucket;
+
+	const int e = bucket / sub_buckets + 2;
+	const unsigned long long sub = bucket % sub_buckets;
+	return ((sub_buckets + sub + 1) << (e - 3)) - 1;
+}
+
+}
+
+struct StageTimers::Histogram
+{
+	std::atomic<unsigned long long> buckets[bucket_count];
+	std::atomic<unsigned long long> total_ns;
+	std::atomic<unsigned long long> max_ns;
+
+	Histogram()
+	{
+		for (auto & b : buckets)
+			b.store(0, std::memory_order_relaxed);
+		total_ns = 0;
+		max_ns = 0;
+	}
+
+	// Moves the samples recorded so far into snapshot and returns their count.
+	// Every field is swapped with zero, the same atomic read-modify-write
+	// record() uses, so each sample is taken exactly once.
+	unsigned long long take(unsigned long long * snapshot, unsigned long long & total, unsigned long long & max)
+	{
+		unsigned long long n = 0;
+		for (int b = 0; b < bucket_count; ++b){
+			snapshot[b] = buckets[b].exchange(0, std::memory_order_relaxed);
+			n += snapshot[b];
+		}
+		total = total_ns.exchange(0, std::memory_order_relaxed);
+		max = max_ns.exchange(0, std::memory_order_relaxed);
+		return n;
+	}
+
+	// smallest bucket bound below which at least fraction of the samples fall
+	static unsigned long long percentile(const unsigned long long * snapshot, unsigned long long n,
+			unsigned long long max, double fraction)
+	{
+		const unsigned long long rank = std::max(1ULL, (unsigned long long)(fraction * n + 0.5));
+		unsigned long long seen = 0;
+		for (int i = 0; i < bucket_count; ++i){
+			seen += snapshot[i];
+			if (seen >= rank)
+				return std::min(bucket_upper(i), max);
+		}
+		return max;
+	}
+};
+
+StageTimers::StageTimers() : stage_count(0)
+{
+}
+
+StageTimers::~StageTimers()
+{
+}
+
+int StageTimers::stage(const std::string & name)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	const int n = stage_count;
+	for (int i = 0; i < n; ++i)
+		if (names[i] == name)
+			return i;
+
+	if (n == max_stages)
+		return max_stages - 1; // out of slots; share the last one
+
+	names[n] = name;
+	histograms[n].reset(new Histogram());
+	stage_count = n + 1; // publishes the histogram to record()
+	return n;
+}
+
+void StageTimers::record(int id, std::chrono::nanoseconds duration)
+{
+	if (id < 0 or id >= stage_count)
+		return;
+
+	Histogram & h = *histograms[id];
+	const unsigned long long ns = std::max<long long>(0, duration.count());
+
+	h.buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+	h.total_ns.fetch_add(ns, std::memory_order_relaxed);
+
+	unsigned long long prev = h.max_ns.load(std::memory_order_relaxed);
+	while (ns > prev and not h.max_ns.compare_exchange_weak(prev, ns, std::memory_order_relaxed))
+		;
+}
+
+void StageTimers::write_csv_header(FILE * file)
+{
+	fprintf(file, "frame,stage,count,mean_us,p50_us,p95_us,p99_us,max_us\n");
+}
+
+void StageTimers::write_csv(FILE * file, unsigned long frame)
+{
+	unsigned long long snapshot[bucket_count];
+
+	const int n = stage_count;
+	for (int i = 0; i < n; ++i){
+		unsigned long long total_ns, max_ns;
+		const unsigned long long count = histograms[i]->take(snapshot, total_ns, max_ns);
+		if (count == 0)
+			continue;
+
+		fprintf(file, "%lu,%s,%llu,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+				frame, names[i].c_str(), count,
+				total_ns / 1000.0 / count,
+				Histogram::percentile(snapshot, count, max_ns, 0.50) / 1000.0,
+				Histogram::percentile(snapshot, count, max_ns, 0.95) / 1000.0,
+				Histogram::percentile(snapshot, count, max_ns, 0.99) / 1000.0,
+				max_ns / 1000.0);
+	}
+
+	fflush(file);
+}
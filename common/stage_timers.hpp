@@ -0,0 +1,79 @@
+#ifndef STAGE_TIMERS_HPP
+#define STAGE_TIMERS_HPP
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Per-stage duration histograms for the frame loop.
+// Recording is lock-free and may happen on any thread. Buckets are spaced
+// logarithmically, 8 per power of two, so percentiles are within ~12%.
+class StageTimers
+{
+public:
+	StageTimers();
+	~StageTimers();
+
+	StageTimers(const StageTimers &) = delete;
+	StageTimers & operator=(const StageTimers &) = delete;
+
+	// Id of the stage with this name, registering it on first use. Look ids up
+	// once at setup; this takes a lock.
+	int stage(const std::string & name);
+
+	void record(int id, std::chrono::nanoseconds duration);
+
+	// Appends count, mean, p50, p95, p99 and max (in microseconds) of every stage
+	// to a CSV file, then starts new histograms. frame labels the rows. May run
+	// while other threads record: a concurrent sample is counted in this dump
+	// or the next one, never lost.
+	void write_csv(FILE * file, unsigned long frame);
+	static void write_csv_header(FILE * file);
+
+	static const int max_stages = 64;
+
+private:
+	struct Histogram;
+
+	std::mutex mutex; // registration only
+	std::string names[max_stages];
+	std::unique_ptr<Histogram> histograms[max_stages];
+	std::atomic<int> stage_count;
+};
+
+// Records the lifetime of the scope into a stage. A null StageTimers makes it a no-op.
+class ScopedStageTimer
+{
+public:
+	ScopedStageTimer(StageTimers * timers_, int id_) : timers(timers_), id(id_)
+	{
+		if (timers)
+			start = std::chrono::steady_clock::now();
+	}
+
+	~ScopedStageTimer()
+	{
+		stop();
+	}
+
+	// Records now instead of at the end of the scope
+	void stop()
+	{
+		if (timers)
+			timers->record(id, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start));
+		timers = nullptr;
+	}
+
+	ScopedStageTimer(const ScopedStageTimer &) = delete;
+	ScopedStageTimer & operator=(const ScopedStageTimer &) = delete;
+
+private:
+	StageTimers * timers;
+	int id;
+	std::chrono::steady_clock::time_point start;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <atomic>
+
+#include "static_layer.hpp"
+
+StaticLayer::StaticLayer(ThreadPool * pool) :
+	recorder(pool)
+{
+}
+
+bool StaticLayer::stale(const glm::mat4 & ViewMatrix, const glm::mat4 & ProjectionMatrix, cv::Size size_,
+		const cv::Scalar & background_)
+{
+	if (valid and ViewMatrix == view and ProjectionMatrix == projection and size_ == size and background_ == background){
+		++reuse_count;
+		return false;
+	}
+
+	valid = false;
+	view = ViewMatrix;
+	projection = ProjectionMatrix;
+	size = size_;
+	background = background_;
+
+	recorder.begin_frame(size);
+	return true;
+}
+
+void StaticLayer::rebuild()
+{
+	// an image only the list still holds is free; the acquire fence pairs with
+	// the release in the last holder's shared_ptr destructor
+	size_t free_image = images.size();
+	for (size_t i = 0; i < images.size() and free_image == images.size(); ++i)
+		if (images[i].use_count() == 1)
+			free_image = i;
+
+	if (free_image == images.size())
+		images.emplace_back(new cv::Mat());
+	else
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+	cv::Mat & layer = *images[free_image];
+	layer.create(size, CV_8UC3);
+	layer.setTo(background);
+	recorder.rasterize(layer);
+
+	current = free_image;
+	valid = true;
+	++rebuild_count;
+}
+
+std::shared_ptr<const cv::Mat> StaticLayer::image() const
+{
+	if (images.empty())
+		return nullptr;
+	return images[current];
+}
+
+void StaticLayer::print_stats(const char * name) const
+{
+	printf("%s: %lu rebuilds, %lu frames reused the cached layer, %zu images\n",
+			name, rebuild_count, reuse_count, images.size());
+}
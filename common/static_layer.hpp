@@ -0,0 +1,59 @@
+#ifndef STATIC_LAYER_HPP
+#define STATIC_LAYER_HPP
+
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <opencv2/opencv.hpp>
+
+#include "tile_rasterizer.hpp"
+
+class ThreadPool;
+
+// Background plus everything drawn by objects that never move, rasterized
+// once and reused for as long as the camera and the frame stay the same.
+// Frames start as a copy of image() and only moving objects are drawn on top,
+// so a still camera costs a copy plus the ships.
+// An image is never written again while anyone else holds it, so a raster
+// thread may copy the previous layer while the next one is built.
+class StaticLayer
+{
+public:
+	// pool = nullptr rasterizes on the calling thread
+	explicit StaticLayer(ThreadPool * pool = nullptr);
+
+	// True when the cached layer does not fit this view. The caller then
+	// records the static objects into raster() and calls rebuild().
+	bool stale(const glm::mat4 & ViewMatrix, const glm::mat4 & ProjectionMatrix, cv::Size size,
+			const cv::Scalar & background);
+	TileRasterizer & raster() { return recorder; }
+	// Rasterizes what was recorded over the background into a new image
+	void rebuild();
+
+	// The layer built last; nullptr before the first rebuild
+	std::shared_ptr<const cv::Mat> image() const;
+
+	unsigned long rebuilds() const { return rebuild_count; }
+	unsigned long reuses() const { return reuse_count; }
+	void print_stats(const char * name) const;
+
+private:
+	TileRasterizer recorder;
+
+	// view the current image was built for
+	bool valid = false;
+	glm::mat4 view;
+	glm::mat4 projection;
+	cv::Size size;
+	cv::Scalar background;
+
+	// images still held by frames in flight, or free to be built into again
+	std::vector<std::shared_ptr<cv::Mat>> images;
+	size_t current = 0;
+
+	unsigned long rebuild_count = 0;
+	unsigned long reuse_count = 0;
+};
+
+#endif
@@ -0,0 +1,27 @@
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "stdout_handle.hpp"
+
+FILE * take_stdout(bool binary){
+	fflush(stdout);
+#ifdef _WIN32
+	const int fd = _dup(_fileno(stdout));
+	if (fd < 0)
+		return nullptr;
+	if (binary)
+		_setmode(fd, _O_BINARY);
+	_dup2(_fileno(stderr), _fileno(stdout));
+	return _fdopen(fd, binary ? "wb" : "w");
+#else
+	const int fd = dup(fileno(stdout));
+	if (fd < 0)
+		return nullptr;
+	dup2(fileno(stderr), fileno(stdout));
+	return fdopen(fd, binary ? "wb" : "w");
+#endif
+}
@@ -0,0 +1,12 @@
+#ifndef STDOUT_HANDLE_HPP
+#define STDOUT_HANDLE_HPP
+
+#include <stdio.h>
+
+// Gives the caller its own handle on the process stdout and points fd 1 at
+// stderr, so printf diagnostics can no longer corrupt what the caller writes
+// there. binary disables newline translation on Windows. Returns nullptr if
+// stdout can't be duplicated.
+FILE * take_stdout(bool binary);
+
+#endif
@@ -0,0 +1,89 @@
+#include <stdio.h>
+
+#include "thread_pool.hpp"
+#include "task_graph.hpp"
+
+TaskGraph::Node TaskGraph::add(std::function<void()> fn)
+{
+	tasks.emplace_back(new Task());
+	tasks.back()->fn = std::move(fn);
+	sorted = false;
+	return tasks.size() - 1;
+}
+
+void TaskGraph::precede(Node before, Node after)
+{
+	tasks[before]->successors.push_back(after);
+	++tasks[after]->dependencies;
+	sorted = false;
+}
+
+bool TaskGraph::sort()
+{
+	std::vector<unsigned> waiting(tasks.size());
+	order.clear();
+	for (Node n = 0; n < tasks.size(); ++n){
+		waiting[n] = tasks[n]->dependencies;
+		if (waiting[n] == 0)
+			order.push_back(n);
+	}
+
+	// order doubles as the queue of ready tasks
+	for (size_t i = 0; i < order.size(); ++i)
+		for (Node s : tasks[order[i]]->successors)
+			if (--waiting[s] == 0)
+				order.push_back(s);
+
+	sorted = order.size() == tasks.size();
+	return sorted;
+}
+
+bool TaskGraph::run(ThreadPool * pool)
+{
+	if (not sorted and not sort()){
+		fprintf(stderr, "Task graph of %zu tasks has a dependency cycle\n", tasks.size());
+		return false;
+	}
+
+	if (pool == nullptr or pool->size() == 1){
+		for (Node n : order)
+			tasks[n]->fn();
+		return true;
+	}
+
+	for (auto & task : tasks)
+		task->remaining = task->dependencies;
+
+	struct Context
+	{
+		TaskGraph * graph;
+		ThreadPool * pool;
+	} context = {this, pool};
+
+	// pool task: begin is the node; its successors are queued before it counts as done
+	auto execute = [](const ThreadPool::Task & job){
+		const Context & c = *static_cast<const Context *>(job.context);
+		Task & task = *c.graph->tasks[job.begin];
+		task.fn();
+
+		for (Node s : task.successors){
+			if (--c.graph->tasks[s]->remaining == 0){
+				ThreadPool::Task next = job;
+				next.begin = s;
+				next.end = s + 1;
+				c.pool->submit(&next, 1);
+			}
+		}
+	};
+
+	std::atomic<size_t> pending(tasks.size());
+	for (Node n = 0; n < tasks.size(); ++n){
+		if (tasks[n]->dependencies == 0){
+			const ThreadPool::Task job = {execute, &context, n, n + 1, &pending};
+			pool->submit(&job, 1);
+		}
+	}
+
+	pool->wait(pending);
+	return true;
+}
@@ -0,0 +1,49 @@
+#ifndef TASK_GRAPH_HPP
+#define TASK_GRAPH_HPP
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class ThreadPool;
+
+// Tasks with dependencies between them, run on a ThreadPool. A task starts
+// as soon as every task it depends on has finished, so independent chains
+// overlap. Tasks may call ThreadPool::parallel_for themselves.
+// The graph is built once and can be run any number of times, e.g. per frame.
+class TaskGraph
+{
+public:
+	typedef size_t Node;
+
+	Node add(std::function<void()> fn);
+	// after starts only once before has finished
+	void precede(Node before, Node after);
+
+	// Runs every task once and returns when all of them finished.
+	// pool = nullptr runs them on the calling thread in dependency order.
+	// Returns false, without running anything, if the dependencies form a cycle.
+	bool run(ThreadPool * pool);
+
+	size_t size() const { return tasks.size(); }
+
+private:
+	struct Task
+	{
+		std::function<void()> fn;
+		std::vector<Node> successors;
+		unsigned dependencies = 0;
+		std::atomic<unsigned> remaining;
+	};
+
+	// Tasks in an order where each one comes after its dependencies
+	bool sort();
+
+	// unique_ptr, as the atomic counters cannot move
+	std::vector<std::unique_ptr<Task>> tasks;
+	std::vector<Node> order;
+	bool sorted = false;
+};
+
+#endif
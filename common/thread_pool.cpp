@@ -0,0 +1,251 @@
+#include <algorithm>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "thread_pool.hpp"
+
+namespace {
+
+// idle rounds a worker looks for work before it goes to sleep
+const int SPIN_ROUNDS = 64;
+// tasks parallel_for_ranges queues at once
+const size_t SUBMIT_BATCH = 64;
+
+// the pool and deque of the calling thread, when it is a worker
+struct CurrentWorker
+{
+	const void * pool;
+	unsigned index;
+};
+thread_local CurrentWorker current_worker = {nullptr, 0};
+
+bool pin_thread(std::thread & thread, unsigned core)
+{
+#if defined(_WIN32)
+	if (core >= sizeof(DWORD_PTR) * 8)
+		return false;
+	return SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << core) != 0;
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core, &set);
+	return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+	// no portable affinity API (macOS only takes hints)
+	(void)thread;
+	(void)core;
+	return false;
+#endif
+}
+
+}
+
+void ThreadPool::TaskQueue::grow()
+{
+	std::vector<Task> bigger(std::max<size_t>(64, ring.size() * 2));
+	for (size_t i = 0; i < count; ++i)
+		bigger[i] = ring[(head + i) % ring.size()];
+	ring.swap(bigger);
+	head = 0;
+}
+
+void ThreadPool::TaskQueue::push_back(const Task * tasks, size_t n)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	while (count + n > ring.size())
+		grow();
+	for (size_t i = 0; i < n; ++i)
+		ring[(head + count + i) % ring.size()] = tasks[i];
+	count += n;
+}
+
+bool ThreadPool::TaskQueue::pop_back(Task & task)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (count == 0)
+		return false;
+	--count;
+	task = ring[(head + count) % ring.size()];
+	return true;
+}
+
+bool ThreadPool::TaskQueue::pop_front(Task & task)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (count == 0)
+		return false;
+	task = ring[head];
+	head = (head + 1) % ring.size();
+	--count;
+	return true;
+}
+
+ThreadPool::ThreadPool(unsigned threads, bool pin) : queued(0), steal_count(0)
+{
+	const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+	if (threads == 0)
+		threads = cores;
+
+	for (unsigned i = 0; i < threads; ++i)
+		queues.emplace_back(new TaskQueue());
+
+	for (unsigned i = 0; i + 1 < threads; ++i){
+		workers.emplace_back(&ThreadPool::worker_loop, this, i);
+		if (pin and pin_thread(workers.back(), (i + 1) % cores))
+			++pinned_count;
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+
+	for (std::thread & t : workers)
+		t.join();
+}
+
+unsigned ThreadPool::current_queue() const
+{
+	if (current_worker.pool == this)
+		return current_worker.index;
+	return unsigned(workers.size());
+}
+
+void ThreadPool::submit(const Task * tasks, size_t n)
+{
+	// counted before they become visible, so a thief never sees the count drop below zero
+	queued += n;
+	queues[current_queue()]->push_back(tasks, n);
+
+	// a sleeper checks its condition under the lock, so it cannot miss this
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+	}
+	wake.notify_all();
+}
+
+void ThreadPool::finish(const Task & task)
+{
+	if (task.pending->fetch_sub(1) == 1){
+		// the waiter may return and free pending as soon as it sees zero
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex);
+		}
+		wake.notify_all();
+	}
+}
+
+bool ThreadPool::run_one(unsigned self)
+{
+	if (queued.load() == 0)
+		return false;
+
+	Task task;
+	bool found = queues[self]->pop_back(task);
+
+	// steal the oldest task, which usually stands for the most work
+	const unsigned n = unsigned(queues.size());
+	for (unsigned k = 1; k < n and not found; ++k){
+		found = queues[(self + k) % n]->pop_front(task);
+		if (found)
+			++steal_count;
+	}
+
+	if (not found)
+		return false;
+
+	--queued;
+	task.run(task);
+	finish(task);
+	return true;
+}
+
+void ThreadPool::wait(std::atomic<size_t> & pending)
+{
+	const unsigned self = current_queue();
+
+	while (pending.load() > 0){
+		if (run_one(self))
+			continue;
+
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		wake.wait(lock, [&]{ return pending.load() == 0 or queued.load() > 0; });
+	}
+}
+
+void ThreadPool::worker_loop(unsigned index)
+{
+	current_worker.pool = this;
+	current_worker.index = index;
+
+	for (;;){
+		bool found = run_one(index);
+		for (int i = 0; i < SPIN_ROUNDS and not found; ++i){
+			std::this_thread::yield();
+			found = run_one(index);
+		}
+		if (found)
+			continue;
+
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		wake.wait(lock, [&]{ return stopping or queued.load() > 0; });
+		if (stopping)
+			return;
+	}
+}
+
+void ThreadPool::parallel_for_ranges(size_t count, size_t grain, const std::function<void(size_t, size_t)> & fn)
+{
+	if (count == 0)
+		return;
+
+	if (grain == 0)
+		grain = std::max<size_t>(1, count / (4 * size()));
+
+	const size_t ranges = (count + grain - 1) / grain;
+	if (workers.empty() or ranges == 1){
+		fn(0, count);
+		return;
+	}
+
+	auto run = [](const Task & task){
+		(*static_cast<const std::function<void(size_t, size_t)> *>(task.context))(task.begin, task.end);
+	};
+
+	std::atomic<size_t> pending(ranges);
+
+	Task batch[SUBMIT_BATCH];
+	size_t batched = 0;
+	for (size_t r = 0; r < ranges; ++r){
+		batch[batched++] = Task{run, &fn, r * grain, std::min(count, (r + 1) * grain), &pending};
+		if (batched == SUBMIT_BATCH or r + 1 == ranges){
+			submit(batch, batched);
+			batched = 0;
+		}
+	}
+
+	wait(pending);
+}
+
+void ThreadPool::parallel_for(size_t count, const std::function<void(size_t)> & fn)
+{
+	// items are usually big (tiles, objects): many small ranges balance best
+	const size_t grain = std::max<size_t>(1, count / (16 * size()));
+
+	parallel_for_ranges(count, grain, [&fn](size_t begin, size_t end){
+		for (size_t i = begin; i < end; ++i)
+			fn(i);
+	});
+}
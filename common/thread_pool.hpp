@@ -0,0 +1,103 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing pool of worker threads.
+// Every worker owns a task deque: it takes its newest task from the back,
+// idle threads steal the oldest task from the front of another deque.
+// A thread waiting for its tasks runs queued tasks meanwhile, so
+// parallel_for may be called from several threads at once and from inside
+// a task. The calling thread takes part in the work, so a pool of size 1
+// runs everything inline.
+class ThreadPool
+{
+public:
+	// threads = 0 uses every hardware thread.
+	// pin binds the workers to cores 1, 2, ... where the platform supports it;
+	// core 0 is left to the thread that created the pool.
+	explicit ThreadPool(unsigned threads = 0, bool pin = false);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool & operator=(const ThreadPool &) = delete;
+
+	// Calls fn(i) for every i in [0, count) and returns when all calls finished
+	void parallel_for(size_t count, const std::function<void(size_t)> & fn);
+
+	// Calls fn(begin, end) for ranges that cover [0, count) and returns when all
+	// calls finished. Ranges hold at least grain items, except the last one;
+	// grain = 0 splits count into a few ranges per thread.
+	void parallel_for_ranges(size_t count, size_t grain, const std::function<void(size_t, size_t)> & fn);
+
+	// Number of threads working on a parallel_for, including the caller
+	unsigned size() const { return unsigned(workers.size()) + 1; }
+	// Workers actually bound to a core
+	unsigned pinned() const { return pinned_count; }
+	// Tasks a thread took from another thread's deque, so far
+	size_t steals() const { return steal_count.load(); }
+
+private:
+	friend class TaskGraph;
+
+	// A unit of work: run(task) processes [begin, end) of context, then
+	// the pool decrements pending
+	struct Task
+	{
+		void (*run)(const Task & task);
+		const void * context;
+		size_t begin;
+		size_t end;
+		std::atomic<size_t> * pending;
+	};
+
+	// Double ended queue of tasks over a ring buffer that only grows
+	class TaskQueue
+	{
+	public:
+		void push_back(const Task * tasks, size_t n);
+		bool pop_back(Task & task);
+		bool pop_front(Task & task);
+
+	private:
+		void grow();
+
+		std::mutex mutex;
+		std::vector<Task> ring;
+		size_t head = 0;
+		size_t count = 0;
+	};
+
+	// Queues tasks on the calling worker's deque, or the shared one for
+	// threads outside the pool, and wakes sleeping threads
+	void submit(const Task * tasks, size_t n);
+	// Runs queued tasks until pending drops to zero
+	void wait(std::atomic<size_t> & pending);
+	// Runs one task from the own deque or a stolen one; false if none was found
+	bool run_one(unsigned self);
+	void finish(const Task & task);
+	// Deque of the calling thread: its worker index, or the shared deque
+	unsigned current_queue() const;
+
+	void worker_loop(unsigned index);
+
+	std::vector<std::thread> workers;
+	// one per worker, then the one shared by threads outside the pool
+	std::vector<std::unique_ptr<TaskQueue>> queues;
+
+	std::atomic<size_t> queued;
+	std::atomic<size_t> steal_count;
+	unsigned pinned_count = 0;
+
+	std::mutex sleep_mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+};
+
+#endif
@@ -0,0 +1,229 @@
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+
+#include "thread_pool.hpp"
+#include "tile_rasterizer.hpp"
+
+TileRasterizer::TileRasterizer(ThreadPool * pool_, int tile_size_) :
+	pool(pool_),
+	tile_size(tile_size_)
+{
+}
+
+void TileRasterizer::begin_frame(cv::Size size_)
+{
+	size = size_;
+	tiles_x = (size.width + tile_size - 1) / tile_size;
+	tiles_y = (size.height + tile_size - 1) / tile_size;
+
+	primitives.clear();
+	segments.clear();
+	marks.clear();
+	faces.clear();
+	bins.resize(tiles_x * tiles_y);
+	for (auto & b : bins)
+		b.clear();
+}
+
+void TileRasterizer::bin(Entry entry, int x0, int y0, int x1, int y1)
+{
+	// reject and clamp against the frame
+	if (x1 < 0 or y1 < 0 or x0 >= size.width or y0 >= size.height)
+		return;
+
+	const int tx0 = std::max(x0, 0) / tile_size;
+	const int ty0 = std::max(y0, 0) / tile_size;
+	const int tx1 = std::min(x1, size.width - 1) / tile_size;
+	const int ty1 = std::min(y1, size.height - 1) / tile_size;
+
+	for (int ty = ty0; ty <= ty1; ++ty)
+		for (int tx = tx0; tx <= tx1; ++tx)
+			bins[ty * tiles_x + tx].push_back(entry);
+}
+
+void TileRasterizer::line(cv::Point pt1, cv::Point pt2, const cv::Scalar & color, int thickness, int line_type)
+{
+	const size_t index = primitives.size();
+	primitives.push_back(Primitive{Primitive::LINE, pt1, pt2, 0, color, thickness, line_type});
+
+	// half the thickness plus a pixel for the round caps and rounding
+	const int margin = thickness / 2 + 2;
+	bin(Entry{unsigned(index), 0},
+			std::min(pt1.x, pt2.x) - margin, std::min(pt1.y, pt2.y) - margin,
+			std::max(pt1.x, pt2.x) + margin, std::max(pt1.y, pt2.y) + margin);
+}
+
+void TileRasterizer::circle(cv::Point center, int radius, const cv::Scalar & color, int thickness, int line_type)
+{
+	const size_t index = primitives.size();
+	primitives.push_back(Primitive{Primitive::CIRCLE, center, center, radius, color, thickness, line_type});
+
+	const int margin = radius + std::max(thickness, 0) / 2 + 2;
+	bin(Entry{unsigned(index), 0}, center.x - margin, center.y - margin, center.x + margin, center.y + margin);
+}
+
+void TileRasterizer::lines(const float * x1, const float * y1, const float * x2, const float * y2, size_t count,
+		const cv::Scalar & color, int thickness)
+{
+	begin_lines(color, thickness);
+	for (size_t i = 0; i < count; ++i)
+		add_line(x1[i], y1[i], x2[i], y2[i]);
+}
+
+void TileRasterizer::markers(const float * x, const float * y, const unsigned char * visible, size_t count,
+		const cv::Scalar & color, int radius)
+{
+	begin_markers(color, radius);
+	for (size_t i = 0; i < count; ++i){
+		if (not visible[i])
+			continue;
+		// also keeps the rounding below in the range of int
+		if (not (x[i] >= -radius and x[i] <= size.width + radius and y[i] >= -radius and y[i] <= size.height + radius))
+			continue;
+		add_marker(cv::Point(int(lroundf(x[i])), int(lroundf(y[i]))));
+	}
+}
+
+void TileRasterizer::begin_lines(const cv::Scalar & color, int thickness)
+{
+	batch = primitives.size();
+	primitives.push_back(Primitive{Primitive::LINES, cv::Point(), cv::Point(), 0, color, thickness, 8});
+}
+
+void TileRasterizer::add_line(float x1, float y1, float x2, float y2)
+{
+	const int thickness = primitives[batch].thickness;
+	SpanSegment segment;
+	if (not span_segment(x1, y1, x2, y2, size, thickness, segment))
+		return;
+
+	const size_t element = segments.size();
+	segments.push_back(segment);
+
+	const int margin = thickness / 2 + 2;
+	bin(Entry{unsigned(batch), unsigned(element)},
+			(std::min(segment.x1, segment.x2) >> SPAN_SHIFT) - margin,
+			(std::min(segment.y1, segment.y2) >> SPAN_SHIFT) - margin,
+			(std::max(segment.x1, segment.x2) >> SPAN_SHIFT) + margin,
+			(std::max(segment.y1, segment.y2) >> SPAN_SHIFT) + margin);
+}
+
+void TileRasterizer::begin_markers(const cv::Scalar & color, int radius)
+{
+	batch = primitives.size();
+	primitives.push_back(Primitive{Primitive::MARKERS, cv::Point(), cv::Point(), radius, color, -1, 8});
+}
+
+void TileRasterizer::add_marker(cv::Point center)
+{
+	const int r = primitives[batch].radius;
+	if (center.x < -r or center.y < -r or center.x > size.width + r or center.y > size.height + r)
+		return;
+
+	const size_t element = marks.size();
+	marks.push_back(center);
+
+	bin(Entry{unsigned(batch), unsigned(element)}, center.x - r, center.y - r, center.x + r, center.y + r);
+}
+
+void TileRasterizer::triangles(const TriangleSetup * setups, size_t count)
+{
+	const size_t index = primitives.size();
+	primitives.push_back(Primitive{Primitive::TRIANGLES, cv::Point(), cv::Point(), 0, cv::Scalar(), -1, 8});
+
+	for (size_t i = 0; i < count; ++i){
+		const TriangleSetup & t = setups[i];
+		const Entry entry{unsigned(index), unsigned(faces.size())};
+		faces.push_back(t);
+
+		// the tiles of the bounding box that are not entirely outside an edge
+		for (int ty = t.y0 / tile_size; ty <= t.y1 / tile_size; ++ty){
+			for (int tx = t.x0 / tile_size; tx <= t.x1 / tile_size; ++tx){
+				const cv::Rect rect(tx * tile_size, ty * tile_size, tile_size, tile_size);
+				if (triangle_overlaps(t, rect))
+					bins[ty * tiles_x + tx].push_back(entry);
+			}
+		}
+	}
+}
+
+void TileRasterizer::draw_tile(cv::Mat & frame, size_t tile) const
+{
+	const int tx = int(tile) % tiles_x;
+	const int ty = int(tile) / tiles_x;
+
+	const cv::Point origin(tx * tile_size, ty * tile_size);
+	const cv::Rect rect(origin.x, origin.y,
+			std::min(tile_size, size.width - origin.x),
+			std::min(tile_size, size.height - origin.y));
+
+	// The ROI shares pixels with frame; shifting by whole pixels keeps the
+	// rasterization identical to drawing into the full frame
+	cv::Mat roi = frame(rect);
+
+	// the span color of the batch the last element came from
+	const Primitive * colored = nullptr;
+	SpanColor color{cv::Scalar()};
+	bool depth_cleared = false;
+
+	for (const Entry & entry : bins[tile]){
+		const Primitive & p = primitives[entry.primitive];
+		if (p.kind == Primitive::LINE){
+			cv::line(roi, p.p1 - origin, p.p2 - origin, p.color, p.thickness, p.line_type);
+			continue;
+		}
+		if (p.kind == Primitive::CIRCLE){
+			cv::circle(roi, p.p1 - origin, p.radius, p.color, p.thickness, p.line_type);
+			continue;
+		}
+		if (p.kind == Primitive::TRIANGLES){
+			if (not depth_cleared){
+				cv::Mat tile_depth = depth(rect);
+				tile_depth.setTo(cv::Scalar(FLT_MAX));
+				depth_cleared = true;
+			}
+			fill_triangle(frame, depth, rect, faces[entry.element]);
+			continue;
+		}
+
+		if (colored != &p){
+			color = SpanColor(p.color);
+			colored = &p;
+		}
+		// the span rasterizer clips to the tile in frame coordinates
+		if (p.kind == Primitive::LINES)
+			span_line(frame, rect, segments[entry.element], p.thickness, color);
+		else
+			span_disc(frame, rect, marks[entry.element], p.radius, color);
+	}
+}
+
+void TileRasterizer::rasterize(cv::Mat & frame)
+{
+	CV_Assert(frame.size() == size);
+	// the span and triangle rasterizers only write packed BGR
+	CV_Assert(frame.type() == CV_8UC3 or (segments.empty() and marks.empty() and faces.empty()));
+	if (not faces.empty())
+		depth.create(size, CV_32FC1);
+
+	busy_tiles.clear();
+	for (size_t tile = 0; tile < bins.size(); ++tile)
+		if (not bins[tile].empty())
+			busy_tiles.push_back(tile);
+
+	auto draw = [&](size_t i){ draw_tile(frame, busy_tiles[i]); };
+
+	if (pool)
+		pool->parallel_for(busy_tiles.size(), draw);
+	else
+		for (size_t i = 0; i < busy_tiles.size(); ++i)
+			draw(i);
+
+	primitives.clear();
+	segments.clear();
+	marks.clear();
+	faces.clear();
+	for (size_t tile : busy_tiles)
+		bins[tile].clear();
+}
@@ -0,0 +1,106 @@
+#ifndef TILE_RASTERIZER_HPP
+#define TILE_RASTERIZER_HPP
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "span_raster.hpp"
+#include "triangle_raster.hpp"
+
+class ThreadPool;
+
+// Collects the lines and circles of a whole frame, bins them into square
+// screen tiles and rasterizes the tiles in parallel. Inside a tile primitives
+// are drawn in submission order, so the result matches drawing them one after
+// another straight into the frame. This is exact for thick lines and circles;
+// 1 px lines are clipped per tile and may step differently near tile borders.
+// Batches of lines and markers go to the span rasterizer instead of OpenCV
+// and are exact too, as are filled triangles. Triangles are depth tested
+// against each other through a depth buffer of the frame; everything else
+// is drawn over what is there.
+class TileRasterizer
+{
+public:
+	// pool = nullptr rasterizes on the calling thread
+	explicit TileRasterizer(ThreadPool * pool = nullptr, int tile_size = 128);
+
+	// Starts recording a frame of the given size; drops anything recorded before
+	void begin_frame(cv::Size size);
+	cv::Size frame_size() const { return size; }
+
+	// Same arguments as cv::line / cv::circle
+	void line(cv::Point pt1, cv::Point pt2, const cv::Scalar & color, int thickness = 1, int line_type = 8);
+	void circle(cv::Point center, int radius, const cv::Scalar & color, int thickness = 1, int line_type = 8);
+
+	// Batch of lines sharing color and thickness, as span_line draws them.
+	// Segment i runs from (x1[i], y1[i]) to (x2[i], y2[i]) in pixels.
+	void lines(const float * x1, const float * y1, const float * x2, const float * y2, size_t count,
+			const cv::Scalar & color, int thickness = 2);
+	// Batch of filled markers of one color around (x[i], y[i]), rounded to
+	// whole pixels; points with visible[i] == 0 are skipped.
+	// Radius 3 covers what cv::circle(center, 2, color, 2) draws.
+	void markers(const float * x, const float * y, const unsigned char * visible, size_t count,
+			const cv::Scalar & color, int radius);
+
+	// The same batches built one element at a time: add_line and add_marker
+	// add to the batch begun last. Elements are binned on their own and
+	// drawn in the order they are added, like separate primitives.
+	void begin_lines(const cv::Scalar & color, int thickness = 2);
+	void add_line(float x1, float y1, float x2, float y2);
+	void begin_markers(const cv::Scalar & color, int radius);
+	void add_marker(cv::Point center);
+
+	// Filled triangles, set up by setup_triangle for a frame of frame_size().
+	// Each is binned only into the tiles it overlaps.
+	void triangles(const TriangleSetup * setups, size_t count);
+
+	// Draws everything recorded since begin_frame into frame
+	void rasterize(cv::Mat & frame);
+
+	size_t primitive_count() const { return primitives.size(); }
+
+private:
+	struct Primitive
+	{
+		enum Kind { LINE, CIRCLE, LINES, MARKERS, TRIANGLES } kind;
+		cv::Point p1;
+		cv::Point p2;     // LINE only
+		int radius;       // CIRCLE and MARKERS only
+		cv::Scalar color;
+		int thickness;
+		int line_type;
+	};
+
+	// A primitive, or one element of a LINES, MARKERS or TRIANGLES batch
+	struct Entry
+	{
+		unsigned primitive;
+		unsigned element;   // index into segments, marks or faces
+	};
+
+	void bin(Entry entry, int x0, int y0, int x1, int y1);
+	void draw_tile(cv::Mat & frame, size_t tile) const;
+
+	ThreadPool * pool;
+	const int tile_size;
+
+	cv::Size size;
+	int tiles_x = 0;
+	int tiles_y = 0;
+
+	std::vector<Primitive> primitives;
+	std::vector<SpanSegment> segments;
+	std::vector<cv::Point> marks;
+	std::vector<TriangleSetup> faces;
+	// index of the batch add_line and add_marker add to
+	size_t batch = 0;
+	// entries per tile, kept between frames to reuse their storage
+	std::vector<std::vector<Entry>> bins;
+	std::vector<size_t> busy_tiles;
+
+	// CV_32FC1, cleared per tile before its first triangle; tiles drawn in
+	// parallel write disjoint parts of it
+	mutable cv::Mat depth;
+};
+
+#endif
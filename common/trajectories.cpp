@@ -0,0 +1,340 @@
+#include <math.h>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRAJECTORIES_SSE2
+#endif
+
+#include "thread_pool.hpp"
+#include "trajectories.hpp"
+
+namespace {
+
+const double TWO_PI = 6.283185307179586;
+
+// ellipses per parallel task, enough to hide the cost of queueing it
+const size_t ELLIPSE_GRAIN = 4096;
+
+// Taylor coefficients of sin and cos, accurate to float precision on [-pi/2, pi/2]
+const float S3 = -1.f / 6, S5 = 1.f / 120, S7 = -1.f / 5040, S9 = 1.f / 362880, S11 = -1.f / 39916800;
+const float C2 = -1.f / 2, C4 = 1.f / 24, C6 = -1.f / 720, C8 = 1.f / 40320, C10 = -1.f / 3628800, C12 = 1.f / 479001600;
+
+// x - round(x) without a libm call: adding 1.5 * 2^52 drops the fraction bits
+// of any |x| < 2^51. Needs strict double arithmetic, as SSE2 code has.
+inline double wrap_turns(double x){
+	const double magic = 6755399441055744.0;
+	return x - ((x + magic) - magic);
+}
+
+// Sine and cosine of one lap fraction f in [-0.5, 0.5]: folds it to a quarter
+// lap around 0 or 0.5, where both series converge fast, and fixes the sign
+inline void sincos_turns(float f, float & s, float & c){
+	const float q = floorf(2 * f + 0.5f);
+	const float x = (f - 0.5f * q) * float(TWO_PI);
+	const float x2 = x * x;
+	s = x * (1 + x2 * (S3 + x2 * (S5 + x2 * (S7 + x2 * (S9 + x2 * S11)))));
+	c = 1 + x2 * (C2 + x2 * (C4 + x2 * (C6 + x2 * (C8 + x2 * (C10 + x2 * C12)))));
+	if (int(q) & 1){
+		s = -s;
+		c = -c;
+	}
+}
+
+inline float lap_fraction(double freq, double phase, double t){
+	double x = phase + freq * t;
+	x = wrap_turns(x);
+	return float(x);
+}
+
+}
+
+size_t TrajectorySet::add_ellipse(const glm::vec3 & center, const glm::vec3 & u, const glm::vec3 & v,
+		float a, float b, double period, double phase)
+{
+	Ellipses & e = ellipses;
+	e.cx.push_back(center.x); e.cy.push_back(center.y); e.cz.push_back(center.z);
+	e.ax.push_back(u.x * a); e.ay.push_back(u.y * a); e.az.push_back(u.z * a);
+	e.bx.push_back(v.x * b); e.by.push_back(v.y * b); e.bz.push_back(v.z * b);
+	e.freq.push_back(1 / period);
+	e.phase.push_back(phase / TWO_PI);
+	e.omega.push_back(float(TWO_PI / period));
+	e.index.push_back(unsigned(kinds.size()));
+
+	kinds.push_back(ELLIPSE);
+	return kinds.size() - 1;
+}
+
+size_t TrajectorySet::add_circle(const glm::vec3 & center, const glm::vec3 & u, const glm::vec3 & v,
+		float r, double period, double phase)
+{
+	return add_ellipse(center, u, v, r, r, period, phase);
+}
+
+size_t TrajectorySet::add_spline(const std::vector<glm::vec3> & points, double period, double phase)
+{
+	Splines & s = splines;
+	s.first.push_back(unsigned(s.points.size()));
+	s.count.push_back(unsigned(points.size()));
+	s.points.insert(s.points.end(), points.begin(), points.end());
+	s.freq.push_back(1 / period);
+	s.phase.push_back(phase);
+	s.index.push_back(unsigned(kinds.size()));
+
+	kinds.push_back(SPLINE);
+	return kinds.size() - 1;
+}
+
+size_t TrajectorySet::add_keyframes(const std::vector<glm::vec3> & positions, const std::vector<double> & times)
+{
+	Keyframes & k = keyframes;
+	const size_t n = std::min(positions.size(), times.size());
+	k.first.push_back(unsigned(k.times.size()));
+	k.count.push_back(unsigned(n));
+	k.last_key.push_back(0);
+	k.times.insert(k.times.end(), times.begin(), times.begin() + n);
+	k.positions.insert(k.positions.end(), positions.begin(), positions.begin() + n);
+	k.index.push_back(unsigned(kinds.size()));
+
+	kinds.push_back(KEYFRAMES);
+	return kinds.size() - 1;
+}
+
+void TrajectorySet::evaluate(double t, std::vector<glm::vec3> & positions, ThreadPool * pool)
+{
+	evaluate_all(t, positions, nullptr, pool);
+}
+
+void TrajectorySet::evaluate(double t, std::vector<glm::vec3> & positions, std::vector<glm::vec3> & velocities,
+		ThreadPool * pool)
+{
+	velocities.resize(kinds.size());
+	evaluate_all(t, positions, velocities.data(), pool);
+}
+
+void TrajectorySet::evaluate_all(double t, std::vector<glm::vec3> & positions, glm::vec3 * velocities, ThreadPool * pool)
+{
+	positions.resize(kinds.size());
+	if (kinds.empty())
+		return;
+
+	const size_t count = ellipses.index.size();
+	if (pool){
+		// captured by reference as a whole, small enough for std::function to keep inline
+		const struct { double t; glm::vec3 * out; glm::vec3 * velocities; } batch = {t, positions.data(), velocities};
+		pool->parallel_for_ranges(count, ELLIPSE_GRAIN, [this, &batch](size_t begin, size_t end){
+			evaluate_ellipses(batch.t, batch.out, batch.velocities, begin, end);
+		});
+	} else {
+		evaluate_ellipses(t, positions.data(), velocities, 0, count);
+	}
+
+	evaluate_splines(t, positions.data(), velocities);
+	evaluate_keyframes(t, positions.data(), velocities);
+}
+
+void TrajectorySet::evaluate_ellipses(double t, glm::vec3 * out, glm::vec3 * velocities, size_t begin, size_t end) const
+{
+	const Ellipses & e = ellipses;
+
+	const double * freq = e.freq.data();
+	const double * phase = e.phase.data();
+	const unsigned * index = e.index.data();
+	size_t i = begin;
+
+#if defined(__AVX2__) || defined(TRAJECTORIES_SSE2)
+#if defined(__AVX2__)
+	const size_t W = 8;
+	typedef __m256 V;
+	auto load = [](const float * p){ return _mm256_loadu_ps(p); };
+	auto set1 = [](float x){ return _mm256_set1_ps(x); };
+	auto add = [](V a, V b){ return _mm256_add_ps(a, b); };
+	auto sub = [](V a, V b){ return _mm256_sub_ps(a, b); };
+	auto mul = [](V a, V b){ return _mm256_mul_ps(a, b); };
+	auto store = [](float * p, V a){ _mm256_storeu_ps(p, a); };
+	// laps done at t, reduced to [-0.5, 0.5] in double so precision does not
+	// fade as t grows, then narrowed to floats
+	auto turns = [freq, phase, t](size_t i){
+		const __m256d vt = _mm256_set1_pd(t);
+		const __m256d magic = _mm256_set1_pd(6755399441055744.0);
+		__m256d lo = _mm256_add_pd(_mm256_loadu_pd(phase + i), _mm256_mul_pd(_mm256_loadu_pd(freq + i), vt));
+		__m256d hi = _mm256_add_pd(_mm256_loadu_pd(phase + i + 4), _mm256_mul_pd(_mm256_loadu_pd(freq + i + 4), vt));
+		lo = _mm256_sub_pd(lo, _mm256_sub_pd(_mm256_add_pd(lo, magic), magic));
+		hi = _mm256_sub_pd(hi, _mm256_sub_pd(_mm256_add_pd(hi, magic), magic));
+		return _mm256_set_m128(_mm256_cvtpd_ps(hi), _mm256_cvtpd_ps(lo));
+	};
+	// lap fraction * 2 rounded to the nearest integer, and that integer's parity as a sign bit
+	auto round_half = [](V f, V & q, V & sign){
+		const __m256i qi = _mm256_cvtps_epi32(_mm256_add_ps(f, f));
+		q = _mm256_cvtepi32_ps(qi);
+		sign = _mm256_castsi256_ps(_mm256_slli_epi32(qi, 31));
+	};
+	auto flip = [](V a, V sign){ return _mm256_xor_ps(a, sign); };
+#else
+	const size_t W = 4;
+	typedef __m128 V;
+	auto load = [](const float * p){ return _mm_loadu_ps(p); };
+	auto set1 = [](float x){ return _mm_set1_ps(x); };
+	auto add = [](V a, V b){ return _mm_add_ps(a, b); };
+	auto sub = [](V a, V b){ return _mm_sub_ps(a, b); };
+	auto mul = [](V a, V b){ return _mm_mul_ps(a, b); };
+	auto store = [](float * p, V a){ _mm_storeu_ps(p, a); };
+	auto turns = [freq, phase, t](size_t i){
+		const __m128d vt = _mm_set1_pd(t);
+		const __m128d magic = _mm_set1_pd(6755399441055744.0);
+		__m128d lo = _mm_add_pd(_mm_loadu_pd(phase + i), _mm_mul_pd(_mm_loadu_pd(freq + i), vt));
+		__m128d hi = _mm_add_pd(_mm_loadu_pd(phase + i + 2), _mm_mul_pd(_mm_loadu_pd(freq + i + 2), vt));
+		lo = _mm_sub_pd(lo, _mm_sub_pd(_mm_add_pd(lo, magic), magic));
+		hi = _mm_sub_pd(hi, _mm_sub_pd(_mm_add_pd(hi, magic), magic));
+		return _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi));
+	};
+	auto round_half = [](V f, V & q, V & sign){
+		const __m128i qi = _mm_cvtps_epi32(_mm_add_ps(f, f));
+		q = _mm_cvtepi32_ps(qi);
+		sign = _mm_castsi128_ps(_mm_slli_epi32(qi, 31));
+	};
+	auto flip = [](V a, V sign){ return _mm_xor_ps(a, sign); };
+#endif
+
+	const V half = set1(0.5f), two_pi = set1(float(TWO_PI)), one = set1(1);
+	float px[W], py[W], pz[W];
+
+	for (; i + W <= end; i += W){
+		V q, sign;
+		const V f = turns(i);
+		round_half(f, q, sign);
+
+		const V x = mul(sub(f, mul(half, q)), two_pi);
+		const V x2 = mul(x, x);
+
+		V s = add(set1(S9), mul(x2, set1(S11)));
+		s = add(set1(S7), mul(x2, s));
+		s = add(set1(S5), mul(x2, s));
+		s = add(set1(S3), mul(x2, s));
+		s = mul(x, add(one, mul(x2, s)));
+
+		V c = add(set1(C10), mul(x2, set1(C12)));
+		c = add(set1(C8), mul(x2, c));
+		c = add(set1(C6), mul(x2, c));
+		c = add(set1(C4), mul(x2, c));
+		c = add(set1(C2), mul(x2, c));
+		c = add(one, mul(x2, c));
+
+		s = flip(s, sign);
+		c = flip(c, sign);
+
+		store(px, add(load(&e.cx[i]), add(mul(load(&e.ax[i]), c), mul(load(&e.bx[i]), s))));
+		store(py, add(load(&e.cy[i]), add(mul(load(&e.ay[i]), c), mul(load(&e.by[i]), s))));
+		store(pz, add(load(&e.cz[i]), add(mul(load(&e.az[i]), c), mul(load(&e.bz[i]), s))));
+
+		for (size_t k = 0; k < W; ++k)
+			out[index[i + k]] = glm::vec3(px[k], py[k], pz[k]);
+
+		if (velocities){
+			// d/dt (a cos + b sin) = omega (b cos - a sin)
+			const V omega = load(&e.omega[i]);
+			store(px, mul(omega, sub(mul(load(&e.bx[i]), c), mul(load(&e.ax[i]), s))));
+			store(py, mul(omega, sub(mul(load(&e.by[i]), c), mul(load(&e.ay[i]), s))));
+			store(pz, mul(omega, sub(mul(load(&e.bz[i]), c), mul(load(&e.az[i]), s))));
+
+			for (size_t k = 0; k < W; ++k)
+				velocities[index[i + k]] = glm::vec3(px[k], py[k], pz[k]);
+		}
+	}
+#endif
+
+	for (; i < end; ++i){
+		float s, c;
+		sincos_turns(lap_fraction(freq[i], phase[i], t), s, c);
+		out[index[i]] = glm::vec3(
+				e.cx[i] + (e.ax[i] * c + e.bx[i] * s),
+				e.cy[i] + (e.ay[i] * c + e.by[i] * s),
+				e.cz[i] + (e.az[i] * c + e.bz[i] * s));
+		if (velocities)
+			velocities[index[i]] = e.omega[i] * glm::vec3(
+					e.bx[i] * c - e.ax[i] * s,
+					e.by[i] * c - e.ay[i] * s,
+					e.bz[i] * c - e.az[i] * s);
+	}
+}
+
+void TrajectorySet::evaluate_splines(double t, glm::vec3 * out, glm::vec3 * velocities) const
+{
+	const Splines & sp = splines;
+
+	for (size_t i = 0; i < sp.index.size(); ++i){
+		const unsigned n = sp.count[i];
+		if (n == 0)
+			continue;
+		const glm::vec3 * p = &sp.points[sp.first[i]];
+
+		// lap fraction in [0, 1) spread over n segments
+		double lap = wrap_turns(sp.phase[i] + sp.freq[i] * t);
+		if (lap < 0)
+			lap += 1;
+		const double u = lap * n;
+		const unsigned seg = std::min(unsigned(u), n - 1);
+		const float s = float(u - seg);
+
+		const glm::vec3 & p0 = p[(seg + n - 1) % n];
+		const glm::vec3 & p1 = p[seg];
+		const glm::vec3 & p2 = p[(seg + 1) % n];
+		const glm::vec3 & p3 = p[(seg + 2) % n];
+
+		// uniform Catmull-Rom basis
+		const float s2 = s * s;
+		const float s3 = s2 * s;
+		out[sp.index[i]] = 0.5f * (
+				(2.f * p1) +
+				(p2 - p0) * s +
+				(2.f * p0 - 5.f * p1 + 4.f * p2 - p3) * s2 +
+				(3.f * p1 - p0 - 3.f * p2 + p3) * s3);
+		// ds/dt = n segments per lap * laps per second
+		if (velocities)
+			velocities[sp.index[i]] = float(0.5 * n * sp.freq[i]) * (
+					(p2 - p0) +
+					(2.f * p0 - 5.f * p1 + 4.f * p2 - p3) * (2 * s) +
+					(3.f * p1 - p0 - 3.f * p2 + p3) * (3 * s2));
+	}
+}
+
+void TrajectorySet::evaluate_keyframes(double t, glm::vec3 * out, glm::vec3 * velocities)
+{
+	Keyframes & kf = keyframes;
+
+	for (size_t i = 0; i < kf.index.size(); ++i){
+		const unsigned n = kf.count[i];
+		if (n == 0)
+			continue;
+		const double * times = &kf.times[kf.first[i]];
+		const glm::vec3 * positions = &kf.positions[kf.first[i]];
+
+		const double period = times[n - 1];
+		if (n == 1 or period <= 0){
+			out[kf.index[i]] = positions[0];
+			if (velocities)
+				velocities[kf.index[i]] = glm::vec3(0, 0, 0);
+			continue;
+		}
+
+		double local = fmod(t, period);
+		if (local < 0)
+			local += period;
+
+		// time mostly moves forward by less than a key: start at the last segment
+		unsigned k = kf.last_key[i];
+		if (k >= n - 1 or times[k] > local)
+			k = 0;
+		while (k + 2 < n and times[k + 1] <= local)
+			++k;
+		kf.last_key[i] = k;
+
+		const double span = times[k + 1] - times[k];
+		const float s = span > 0 ? float((local - times[k]) / span) : 0.f;
+		out[kf.index[i]] = positions[k] + (positions[k + 1] - positions[k]) * s;
+		if (velocities)
+			velocities[kf.index[i]] = span > 0 ? (positions[k + 1] - positions[k]) / float(span) : glm::vec3(0, 0, 0);
+	}
+}
@@ -0,0 +1,83 @@
+#ifndef TRAJECTORIES_HPP
+#define TRAJECTORIES_HPP
+
+#include <vector>
+#include <glm/glm.hpp>
+
+class ThreadPool;
+
+// Paths of many flyers, evaluated together for one timestamp.
+// Parameters are kept per kind in separate arrays (SoA), so the ellipse
+// kernel, which covers circular orbits, runs over contiguous floats with
+// SSE2/AVX2 and polynomial sine and cosine instead of a libm call per flyer.
+// Every path repeats with its period; t is the simulation time in seconds.
+class TrajectorySet
+{
+public:
+	// Ellipse center + u * a * cos(theta) + v * b * sin(theta), u and v
+	// orthonormal, theta = 2 pi t / period + phase (radians)
+	size_t add_ellipse(const glm::vec3 & center, const glm::vec3 & u, const glm::vec3 & v,
+			float a, float b, double period, double phase);
+	size_t add_circle(const glm::vec3 & center, const glm::vec3 & u, const glm::vec3 & v,
+			float r, double period, double phase);
+
+	// Closed Catmull-Rom spline through points, once around per period;
+	// phase is the fraction of a lap done at t = 0
+	size_t add_spline(const std::vector<glm::vec3> & points, double period, double phase);
+
+	// Linear motion between positions[k] at times[k]; times start at 0 and
+	// increase, the last one is the period. Repeat the first position last
+	// for a closed loop.
+	size_t add_keyframes(const std::vector<glm::vec3> & positions, const std::vector<double> & times);
+
+	size_t size() const { return kinds.size(); }
+
+	// Positions of every path at time t, in the order they were added.
+	// pool = nullptr evaluates on the calling thread.
+	void evaluate(double t, std::vector<glm::vec3> & positions, ThreadPool * pool = nullptr);
+	// ... and their analytic derivatives in units per second, tangent to the paths
+	void evaluate(double t, std::vector<glm::vec3> & positions, std::vector<glm::vec3> & velocities,
+			ThreadPool * pool = nullptr);
+
+private:
+	enum Kind { ELLIPSE, SPLINE, KEYFRAMES };
+
+	// velocities may be null
+	void evaluate_all(double t, std::vector<glm::vec3> & positions, glm::vec3 * velocities, ThreadPool * pool);
+	// ellipses [begin, end)
+	void evaluate_ellipses(double t, glm::vec3 * out, glm::vec3 * velocities, size_t begin, size_t end) const;
+	void evaluate_splines(double t, glm::vec3 * out, glm::vec3 * velocities) const;
+	void evaluate_keyframes(double t, glm::vec3 * out, glm::vec3 * velocities);
+
+	std::vector<unsigned char> kinds;
+
+	struct Ellipses
+	{
+		std::vector<float> cx, cy, cz;  // center
+		std::vector<float> ax, ay, az;  // u * a
+		std::vector<float> bx, by, bz;  // v * b
+		std::vector<double> freq;       // laps per second
+		std::vector<double> phase;      // laps done at t = 0
+		std::vector<float> omega;       // radians per second
+		std::vector<unsigned> index;    // position in the output
+	} ellipses;
+
+	struct Splines
+	{
+		std::vector<unsigned> first, count;     // control points in points
+		std::vector<double> freq, phase;
+		std::vector<unsigned> index;
+		std::vector<glm::vec3> points;
+	} splines;
+
+	struct Keyframes
+	{
+		std::vector<unsigned> first, count;     // keys in times / positions
+		std::vector<unsigned> last_key;         // segment found at the last evaluation
+		std::vector<unsigned> index;
+		std::vector<double> times;
+		std::vector<glm::vec3> positions;
+	} keyframes;
+};
+
+#endif
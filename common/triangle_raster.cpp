@@ -0,0 +1,379 @@
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRIANGLE_RASTER_SSE2
+#endif
+
+#include "span_raster.hpp"
+#include "triangle_raster.hpp"
+
+namespace {
+
+// Pixel coordinates setup_triangle accepts, so that a and b stay below
+// 2^24 and an edge function varies by less than 2^31 over a block
+const double MAX_PIXEL = 32768;
+
+// Guard band of setup_triangles: clip space |x|, |y| <= GUARD_BAND * w, about
+// one viewport beyond each edge. Triangles crossing the viewport edges rarely
+// reach it, so they are drawn without being cut.
+const float GUARD_BAND = 3;
+
+const int BLOCK = 8;
+
+uint8_t channel(double v)
+{
+	return (uint8_t)(std::min(255.0, std::max(0.0, floor(v + 0.5))));
+}
+
+// Clip space vertex
+struct ClipVertex
+{
+	float x;
+	float y;
+	float z;
+	float w;
+};
+
+// Signed distances to the clip planes, >= 0 inside: near, then the guard band
+inline float plane_distance(const ClipVertex & v, int plane)
+{
+	switch (plane){
+	case 0: return v.z + v.w;
+	case 1: return GUARD_BAND * v.w - v.x;
+	case 2: return GUARD_BAND * v.w + v.x;
+	case 3: return GUARD_BAND * v.w - v.y;
+	default: return GUARD_BAND * v.w + v.y;
+	}
+}
+const int CLIP_PLANES = 5;
+
+// Sutherland-Hodgman against one plane; returns the vertex count of out
+int clip_polygon(const ClipVertex * in, int count, int plane, ClipVertex * out)
+{
+	int n = 0;
+	for (int i = 0; i < count; ++i){
+		const ClipVertex & a = in[i];
+		const ClipVertex & b = in[(i + 1) % count];
+		const float da = plane_distance(a, plane);
+		const float db = plane_distance(b, plane);
+
+		if (da >= 0)
+			out[n++] = a;
+		if ((da >= 0) != (db >= 0)){
+			const float t = da / (da - db);
+			out[n++] = ClipVertex{
+				a.x + t * (b.x - a.x),
+				a.y + t * (b.y - a.y),
+				a.z + t * (b.z - a.z),
+				a.w + t * (b.w - a.w),
+			};
+		}
+	}
+	return n;
+}
+
+// Draws the pixels [x0, x1] x [y0, y1] of one block. e holds the edge
+// functions at (x0, y0); only the edges in partial are tested per pixel.
+void fill_block(cv::Mat & frame, cv::Mat & depth, const TriangleSetup & t,
+		int x0, int y0, int x1, int y1, const int64_t * e, int partial)
+{
+	const int w = x1 - x0 + 1;
+
+	int edges[3];
+	int edge_count = 0;
+	for (int k = 0; k < 3; ++k)
+		if (partial & (1 << k))
+			edges[edge_count++] = k;
+
+#if defined(__AVX2__)
+	const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(w), lane);
+	const __m256i minus_one = _mm256_set1_epi32(-1);
+	const __m256 z_step = _mm256_mul_ps(_mm256_cvtepi32_ps(lane), _mm256_set1_ps(float(t.dzdx)));
+
+	__m256i e_step[3];
+	for (int i = 0; i < edge_count; ++i)
+		e_step[i] = _mm256_mullo_epi32(lane, _mm256_set1_epi32(t.a[edges[i]]));
+#elif defined(TRIANGLE_RASTER_SSE2)
+	// the row as two halves of 4 lanes; SSE2 has no 32 bit multiply, so the
+	// lane offsets are spelled out, rounded as the AVX2 path rounds them
+	const __m128i minus_one = _mm_set1_epi32(-1);
+	const __m128i valid[2] = {
+		_mm_cmpgt_epi32(_mm_set1_epi32(w), _mm_setr_epi32(0, 1, 2, 3)),
+		_mm_cmpgt_epi32(_mm_set1_epi32(w), _mm_setr_epi32(4, 5, 6, 7)),
+	};
+	const float dz = float(t.dzdx);
+	const __m128 z_step[2] = {
+		_mm_setr_ps(0 * dz, 1 * dz, 2 * dz, 3 * dz),
+		_mm_setr_ps(4 * dz, 5 * dz, 6 * dz, 7 * dz),
+	};
+
+	__m128i e_step[3][2];
+	for (int i = 0; i < edge_count; ++i){
+		const int32_t a = t.a[edges[i]];
+		e_step[i][0] = _mm_setr_epi32(0, a, 2 * a, 3 * a);
+		e_step[i][1] = _mm_setr_epi32(4 * a, 5 * a, 6 * a, 7 * a);
+	}
+#endif
+
+	for (int y = y0; y <= y1; ++y){
+		const int row = y - y0;
+		// a partial edge crosses the block, so it fits 32 bits anywhere in it
+		int32_t e_row[3];
+		for (int i = 0; i < edge_count; ++i)
+			e_row[i] = int32_t(e[edges[i]] + int64_t(t.b[edges[i]]) * row);
+
+		const float z_row = float(t.z0 + t.dzdx * x0 + t.dzdy * y);
+		float * d = depth.ptr<float>(y) + x0;
+		unsigned char * p = frame.ptr<unsigned char>(y) + 3 * x0;
+
+		int bits = 0;
+#if defined(__AVX2__)
+		__m256i mask = valid;
+		for (int i = 0; i < edge_count; ++i){
+			const __m256i edge = _mm256_add_epi32(_mm256_set1_epi32(e_row[i]), e_step[i]);
+			mask = _mm256_and_si256(mask, _mm256_cmpgt_epi32(edge, minus_one));
+		}
+		if (_mm256_testz_si256(mask, mask))
+			continue;
+
+		// masked loads and stores never touch pixels past x1
+		const __m256 z = _mm256_add_ps(_mm256_set1_ps(z_row), z_step);
+		const __m256 old = _mm256_maskload_ps(d, mask);
+		const __m256i pass = _mm256_and_si256(mask, _mm256_castps_si256(_mm256_cmp_ps(z, old, _CMP_LT_OQ)));
+		_mm256_maskstore_ps(d, pass, z);
+		bits = _mm256_movemask_ps(_mm256_castsi256_ps(pass));
+#elif defined(TRIANGLE_RASTER_SSE2)
+		for (int h = 0; h < 2 and 4 * h < w; ++h){
+			__m128i mask = valid[h];
+			for (int i = 0; i < edge_count; ++i){
+				const __m128i edge = _mm_add_epi32(_mm_set1_epi32(e_row[i]), e_step[i][h]);
+				mask = _mm_and_si128(mask, _mm_cmpgt_epi32(edge, minus_one));
+			}
+			if (_mm_movemask_epi8(mask) == 0)
+				continue;
+
+			// there are no masked loads: a half the block ends in goes through
+			// a copy, so pixels past x1 are never touched
+			const int n = std::min(4, w - 4 * h);
+			float * dh = d + 4 * h;
+			float tail[4] = {0, 0, 0, 0};
+			float * src = dh;
+			if (n < 4){
+				memcpy(tail, dh, n * sizeof(float));
+				src = tail;
+			}
+
+			const __m128 z = _mm_add_ps(_mm_set1_ps(z_row), z_step[h]);
+			const __m128 old = _mm_loadu_ps(src);
+			const __m128 pass = _mm_and_ps(_mm_castsi128_ps(mask), _mm_cmplt_ps(z, old));
+			_mm_storeu_ps(src, _mm_or_ps(_mm_and_ps(pass, z), _mm_andnot_ps(pass, old)));
+			if (n < 4)
+				memcpy(dh, tail, n * sizeof(float));
+			bits |= _mm_movemask_ps(pass) << (4 * h);
+		}
+#else
+		for (int i = 0; i < w; ++i){
+			bool inside = true;
+			for (int k = 0; k < edge_count; ++k)
+				inside = inside and e_row[k] + t.a[edges[k]] * i >= 0;
+			if (not inside)
+				continue;
+
+			const float z = z_row + float(t.dzdx) * i;
+			if (z < d[i]){
+				d[i] = z;
+				bits |= 1 << i;
+			}
+		}
+#endif
+
+		for (int i = 0; i < w; ++i)
+			if (bits & (1 << i))
+				memcpy(p + 3 * i, t.color, 3);
+	}
+}
+
+}
+
+bool setup_triangle(const float * x, const float * y, const float * z, const cv::Scalar & color, cv::Size size,
+		TriangleSetup & t)
+{
+	int64_t X[3];
+	int64_t Y[3];
+	double Z[3];
+	for (int i = 0; i < 3; ++i){
+		// also rejects NaN
+		if (not (fabs(x[i]) < MAX_PIXEL and fabs(y[i]) < MAX_PIXEL))
+			return false;
+		X[i] = llround(double(x[i]) * SPAN_ONE);
+		Y[i] = llround(double(y[i]) * SPAN_ONE);
+		Z[i] = z[i];
+	}
+
+	// make the edge functions positive inside
+	const int64_t area = (X[1] - X[0]) * (Y[2] - Y[0]) - (Y[1] - Y[0]) * (X[2] - X[0]);
+	if (area == 0)
+		return false;
+	if (area < 0){
+		std::swap(X[1], X[2]);
+		std::swap(Y[1], Y[2]);
+		std::swap(Z[1], Z[2]);
+	}
+
+	// pixel centers the bounding box holds, cut to the frame
+	t.x0 = std::max(int(ceil(std::min(X[0], std::min(X[1], X[2])) / double(SPAN_ONE))), 0);
+	t.y0 = std::max(int(ceil(std::min(Y[0], std::min(Y[1], Y[2])) / double(SPAN_ONE))), 0);
+	t.x1 = std::min(int(floor(std::max(X[0], std::max(X[1], X[2])) / double(SPAN_ONE))), size.width - 1);
+	t.y1 = std::min(int(floor(std::max(Y[0], std::max(Y[1], Y[2])) / double(SPAN_ONE))), size.height - 1);
+	if (t.x0 > t.x1 or t.y0 > t.y1)
+		return false;
+
+	for (int i = 0; i < 3; ++i){
+		const int j = (i + 1) % 3;
+		const int64_t dx = X[j] - X[i];
+		const int64_t dy = Y[j] - Y[i];
+
+		// dx (py - Y[i]) - dy (px - X[i]) at p = SPAN_ONE * (x, y)
+		t.a[i] = int32_t(-dy * SPAN_ONE);
+		t.b[i] = int32_t(dx * SPAN_ONE);
+		t.c[i] = dy * X[i] - dx * Y[i];
+
+		// A pixel center on an edge belongs to the triangle on one side of it
+		// only: the edge runs the other way in the other triangle
+		if (not (dy > 0 or (dy == 0 and dx < 0)))
+			t.c[i] -= 1;
+	}
+
+	const double x0 = double(X[0]) / SPAN_ONE;
+	const double y0 = double(Y[0]) / SPAN_ONE;
+	const double e1x = double(X[1] - X[0]) / SPAN_ONE;
+	const double e1y = double(Y[1] - Y[0]) / SPAN_ONE;
+	const double e2x = double(X[2] - X[0]) / SPAN_ONE;
+	const double e2y = double(Y[2] - Y[0]) / SPAN_ONE;
+	const double det = e1x * e2y - e1y * e2x;
+	t.dzdx = ((Z[1] - Z[0]) * e2y - (Z[2] - Z[0]) * e1y) / det;
+	t.dzdy = ((Z[2] - Z[0]) * e1x - (Z[1] - Z[0]) * e2x) / det;
+	t.z0 = Z[0] - t.dzdx * x0 - t.dzdy * y0;
+
+	t.color[0] = channel(color[0]);
+	t.color[1] = channel(color[1]);
+	t.color[2] = channel(color[2]);
+	return true;
+}
+
+void setup_triangles(const ProjectedVertices & vertices, const cv::Scalar * colors, int width, int height,
+		std::vector<TriangleSetup> & triangles)
+{
+	const cv::Size size(width, height);
+	const float fw = float(width);
+	const float fh = float(height);
+	// the viewport mapping of project_vertices
+	const float half_w = float(width / 2);
+	const float half_h = float(height / 2);
+
+	ClipVertex polygon[3 + CLIP_PLANES];
+	ClipVertex scratch[3 + CLIP_PLANES];
+
+	for (size_t i = 0; i + 2 < vertices.size(); i += 3){
+		for (int k = 0; k < 3; ++k)
+			polygon[k] = ClipVertex{vertices.cx[i + k], vertices.cy[i + k], vertices.cz[i + k], vertices.w[i + k]};
+
+		// cut only by the planes some corner is outside of
+		int count = 3;
+		for (int plane = 0; plane < CLIP_PLANES and count >= 3; ++plane){
+			bool inside = true;
+			for (int k = 0; k < count; ++k)
+				inside = inside and plane_distance(polygon[k], plane) >= 0;
+			if (inside)
+				continue;
+			count = clip_polygon(polygon, count, plane, scratch);
+			std::copy(scratch, scratch + count, polygon);
+		}
+		if (count < 3)
+			continue;
+
+		float x[3 + CLIP_PLANES];
+		float y[3 + CLIP_PLANES];
+		float z[3 + CLIP_PLANES];
+		for (int k = 0; k < count; ++k){
+			const ClipVertex & v = polygon[k];
+			x[k] = v.x / v.w * fw / 2 + half_w;
+			y[k] = fh - (v.y / v.w * fh / 2 + half_h);
+			z[k] = v.z / v.w;
+		}
+
+		// the clipped polygon is convex: a fan around its first vertex
+		for (int k = 1; k + 1 < count; ++k){
+			const float fx[3] = {x[0], x[k], x[k + 1]};
+			const float fy[3] = {y[0], y[k], y[k + 1]};
+			const float fz[3] = {z[0], z[k], z[k + 1]};
+			TriangleSetup t;
+			if (setup_triangle(fx, fy, fz, colors[i / 3], size, t))
+				triangles.push_back(t);
+		}
+	}
+}
+
+bool triangle_overlaps(const TriangleSetup & t, const cv::Rect & rect)
+{
+	const int x0 = std::max(t.x0, rect.x);
+	const int y0 = std::max(t.y0, rect.y);
+	const int x1 = std::min(t.x1, rect.x + rect.width - 1);
+	const int y1 = std::min(t.y1, rect.y + rect.height - 1);
+	if (x0 > x1 or y0 > y1)
+		return false;
+
+	// the largest value of each edge function over the rectangle's corners
+	for (int k = 0; k < 3; ++k){
+		const int64_t e = int64_t(t.a[k]) * (t.a[k] > 0 ? x1 : x0) + int64_t(t.b[k]) * (t.b[k] > 0 ? y1 : y0) + t.c[k];
+		if (e < 0)
+			return false;
+	}
+	return true;
+}
+
+void fill_triangle(cv::Mat & frame, cv::Mat & depth, const cv::Rect & clip, const TriangleSetup & t)
+{
+	const int x0 = std::max(t.x0, clip.x);
+	const int y0 = std::max(t.y0, clip.y);
+	const int x1 = std::min(t.x1, clip.x + clip.width - 1);
+	const int y1 = std::min(t.y1, clip.y + clip.height - 1);
+
+	// blocks on the frame's 8x8 grid, cut to the clipped bounding box
+	for (int by = y0 - y0 % BLOCK; by <= y1; by += BLOCK){
+		const int block_y0 = std::max(by, y0);
+		const int block_y1 = std::min(by + BLOCK - 1, y1);
+
+		for (int bx = x0 - x0 % BLOCK; bx <= x1; bx += BLOCK){
+			const int block_x0 = std::max(bx, x0);
+			const int block_x1 = std::min(bx + BLOCK - 1, x1);
+
+			// per edge: skip the block when it is outside, test it per pixel
+			// only when the edge crosses it
+			int64_t e[3];
+			int partial = 0;
+			bool outside = false;
+			for (int k = 0; k < 3 and not outside; ++k){
+				e[k] = int64_t(t.a[k]) * block_x0 + int64_t(t.b[k]) * block_y0 + t.c[k];
+				const int64_t ex = int64_t(t.a[k]) * (block_x1 - block_x0);
+				const int64_t ey = int64_t(t.b[k]) * (block_y1 - block_y0);
+				const int64_t e_max = e[k] + std::max(ex, int64_t(0)) + std::max(ey, int64_t(0));
+				const int64_t e_min = e[k] + std::min(ex, int64_t(0)) + std::min(ey, int64_t(0));
+				if (e_max < 0)
+					outside = true;
+				else if (e_min < 0)
+					partial |= 1 << k;
+			}
+			if (outside)
+				continue;
+
+			fill_block(frame, depth, t, block_x0, block_y0, block_x1, block_y1, e, partial);
+		}
+	}
+}
@@ -0,0 +1,71 @@
+#ifndef TRIANGLE_RASTER_HPP
+#define TRIANGLE_RASTER_HPP
+
+#include <stdint.h>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "projection.hpp"
+
+// Depth buffered rasterizer for filled, flat colored triangles into packed
+// BGR (CV_8UC3) frames with a float (CV_32FC1) depth buffer of the same size.
+//
+// Pixel (x, y) is sampled at the point (x, y), as span_raster does. Vertices
+// snap to 1 / SPAN_ONE pixels and coverage is decided by exact integer edge
+// functions with a tie rule for pixels on an edge, so triangles sharing an
+// edge neither overlap nor leave gaps. Like the span rasterizer, the pixels
+// a triangle writes do not depend on the clip rectangle it is drawn with.
+//
+// A triangle is first tested against whole 8x8 pixel blocks: blocks outside
+// an edge are skipped, and edges a block is entirely inside of are not
+// evaluated per pixel. The rest are evaluated a row of the block at a time,
+// 8 pixels wide with AVX2, 4 wide with SSE2 and per pixel elsewhere.
+
+// A triangle set up for fill_triangle
+struct TriangleSetup
+{
+	// Edge functions e(x, y) = a x + b y + c of pixel (x, y), biased by the tie
+	// rule; the triangle covers the pixels where all three are >= 0
+	int32_t a[3];
+	int32_t b[3];
+	int64_t c[3];
+
+	// depth of pixel (x, y): z = z0 + dzdx x + dzdy y; smaller is nearer
+	double z0;
+	double dzdx;
+	double dzdy;
+
+	// pixels its bounding box covers, inclusive
+	int x0;
+	int y0;
+	int x1;
+	int y1;
+
+	unsigned char color[3];   // BGR
+};
+
+// Sets up the triangle between pixel positions (x[i], y[i]) with depths z[i].
+// False when it covers no pixel of a frame of the given size, or reaches
+// further than 32768 pixels from the frame origin, beyond which the edge
+// functions could overflow.
+bool setup_triangle(const float * x, const float * y, const float * z, const cv::Scalar & color, cv::Size size,
+		TriangleSetup & triangle);
+
+// Appends the setups of the triangles of a projected triangle soup, triangle
+// i being vertices 3i, 3i + 1 and 3i + 2, face i colored colors[i]. Clips
+// them in clip space against the near plane and a guard band around the
+// viewport first, so triangles reaching behind the camera are cut instead
+// of dropped. Depth is the normalized device z.
+void setup_triangles(const ProjectedVertices & vertices, const cv::Scalar * colors, int width, int height,
+		std::vector<TriangleSetup> & triangles);
+
+// True when the triangle may cover a pixel of rect; false only when rect is
+// entirely outside one of its edges
+bool triangle_overlaps(const TriangleSetup & triangle, const cv::Rect & rect);
+
+// Draws the pixels of the triangle inside clip that pass the depth test
+// (nearer than depth holds) and stores their depth
+void fill_triangle(cv::Mat & frame, cv::Mat & depth, const cv::Rect & clip, const TriangleSetup & triangle);
+
+#endif
@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <chrono>
+
+#include "stdout_handle.hpp"
+#include "video_output.hpp"
+
+namespace {
+
+bool ends_with(const std::string & s, const char * suffix){
+	const std::string tail(suffix);
+	return s.size() >= tail.size() and s.compare(s.size() - tail.size(), tail.size(), tail) == 0;
+}
+
+}
+
+std::unique_ptr<VideoOutput> VideoOutput::open(const std::string & target, cv::Size size, double fps, size_t queue_depth)
+{
+	Format format = VIDEO_WRITER;
+	if (target == "-" or ends_with(target, ".y4m"))
+		format = Y4M;
+	else if (ends_with(target, ".bgr"))
+		format = RAW;
+
+	if (format == Y4M and (size.width % 2 or size.height % 2)){
+		fprintf(stderr, "Y4M output needs an even frame size, got %dx%d\n", size.width, size.height);
+		return nullptr;
+	}
+
+	std::unique_ptr<VideoOutput> out(new VideoOutput(format, size, queue_depth));
+
+	if (format == VIDEO_WRITER){
+		const int fourcc = ends_with(target, ".avi")
+				? cv::VideoWriter::fourcc('M', 'J', 'P', 'G')
+				: cv::VideoWriter::fourcc('m', 'p', '4', 'v');
+		if (not out->writer.open(target, fourcc, fps, size)){
+			fprintf(stderr, "Impossible to open video %s\n", target.c_str());
+			return nullptr;
+		}
+	} else {
+		if (target == "-"){
+			out->file = take_stdout(true);
+		} else {
+			out->file = fopen(target.c_str(), "wb");
+		}
+
+		if (out->file == nullptr){
+			fprintf(stderr, "Impossible to open %s\n", target.c_str());
+			return nullptr;
+		}
+
+		if (format == Y4M){
+			// frame rate as a fraction in thousandths, e.g. 60000:1000
+			fprintf(out->file, "YUV4MPEG2 W%d H%d F%ld:1000 Ip A1:1 C420jpeg\n",
+					size.width, size.height, long(fps * 1000 + 0.5));
+		}
+	}
+
+	out->encoder = std::thread(&VideoOutput::encoder_loop, out.get());
+	return out;
+}
+
+VideoOutput::VideoOutput(Format format_, cv::Size size_, size_t queue_depth) :
+	format(format_),
+	size(size_),
+	frames(size_, CV_8UC3, queue_depth + 2),
+	queue(queue_depth),
+	stopping(false),
+	written(0)
+{
+}
+
+VideoOutput::~VideoOutput()
+{
+	finish();
+
+	if (file)
+		fclose(file);
+	writer.release();
+}
+
+void VideoOutput::finish()
+{
+	if (encoder.joinable()){
+		stopping = true;
+		encoder.join();
+	}
+}
+
+void VideoOutput::write(const cv::Mat & frame)
+{
+	FramePool::Frame copy = frames.acquire();
+	frame.copyTo(copy.mat);
+
+	SpinWait spin;
+	bool waited = false;
+	while (not queue.try_push(std::move(copy))){
+		waited = true;
+		spin.wait();
+	}
+
+	if (waited)
+		++waits;
+}
+
+void VideoOutput::encoder_loop()
+{
+	SpinWait spin;
+	FramePool::Frame frame;
+
+	for (;;){
+		if (not queue.try_pop(frame)){
+			// the producer is done once stopping is set, so an empty queue is final
+			if (stopping and queue.empty())
+				return;
+			spin.wait();
+			continue;
+		}
+		spin.reset();
+
+		const auto start = std::chrono::steady_clock::now();
+		encode(frame.mat);
+		encode_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		frame.release();
+		++written;
+	}
+}
+
+void VideoOutput::encode(const cv::Mat & frame)
+{
+	if (format == VIDEO_WRITER){
+		writer.write(frame);
+		return;
+	}
+
+	const cv::Mat * out = &frame;
+	if (format == Y4M){
+		fputs("FRAME\n", file);
+		// planar Y, then U and V at half resolution
+		cv::cvtColor(frame, yuv, cv::COLOR_BGR2YUV_I420);
+		out = &yuv;
+	}
+
+	const size_t row_bytes = out->cols * out->elemSize();
+	for (int r = 0; r < out->rows; ++r)
+		fwrite(out->ptr(r), 1, row_bytes, file);
+}
+
+void VideoOutput::print_stats(const char * name) const
+{
+	const unsigned long n = written;
+	printf("%s: %lu frames encoded, %.2f ms per frame, producer waited %lu times\n",
+			name, n, n ? encode_seconds * 1000 / n : 0.0, waits);
+}
@@ -0,0 +1,71 @@
+#ifndef VIDEO_OUTPUT_HPP
+#define VIDEO_OUTPUT_HPP
+
+#include <stdio.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <opencv2/opencv.hpp>
+
+#include "frame_pool.hpp"
+#include "spsc_queue.hpp"
+
+// Streams BGR frames to a video file or a raw pipe from a background thread.
+// write() copies the frame into a pooled buffer and queues it; when the queue
+// is full it waits instead of dropping, so every frame written is encoded.
+// write() must always be called from the same thread.
+//
+// Targets:
+//   -              YUV4MPEG2 (4:2:0) on stdout, e.g. | ffmpeg -i - out.mkv
+//   name.y4m       YUV4MPEG2 (4:2:0) file
+//   name.bgr       headerless bgr24 frames, e.g. ffmpeg -f rawvideo -pix_fmt bgr24 -s WxH -i name.bgr
+//   anything else  cv::VideoWriter; MJPG in .avi, mp4v otherwise
+class VideoOutput
+{
+public:
+	// Returns nullptr, after printing why, if the target cannot be opened
+	static std::unique_ptr<VideoOutput> open(const std::string & target, cv::Size size, double fps, size_t queue_depth = 8);
+
+	// Calls finish(), then closes the output
+	~VideoOutput();
+
+	VideoOutput(const VideoOutput &) = delete;
+	VideoOutput & operator=(const VideoOutput &) = delete;
+
+	void write(const cv::Mat & frame);
+
+	// Encodes what is still queued and stops the encoder thread; write() must
+	// not be called afterwards
+	void finish();
+
+	// Call after finish(), when the encoder thread no longer counts
+	void print_stats(const char * name) const;
+
+private:
+	enum Format { Y4M, RAW, VIDEO_WRITER };
+
+	VideoOutput(Format format, cv::Size size, size_t queue_depth);
+
+	void encoder_loop();
+	void encode(const cv::Mat & frame);
+
+	const Format format;
+	const cv::Size size;
+
+	FILE * file = nullptr;
+	cv::VideoWriter writer;
+	cv::Mat yuv; // Y4M conversion buffer, reused
+
+	FramePool frames;
+	SpscQueue<FramePool::Frame> queue;
+
+	std::atomic<bool> stopping;
+	std::atomic<unsigned long> written;
+	unsigned long waits = 0;       // write() calls that found the queue full; writer thread only
+	double encode_seconds = 0;     // encoder thread only, read after finish()
+
+	std::thread encoder;
+};
+
+#endif
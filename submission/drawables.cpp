@@ -0,0 +1,238 @@
+#include <vector>
+#include <algorithm>
+#include <math.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+#include <opencv2/opencv.hpp>
+
+#include "drawables.hpp"
+
+using glm::quat;
+using glm::vec3;
+#include <common/quaternion_utils.hpp>
+
+// Ship mesh:
+// 4 triangles
+// 5 unique vertices
+// 4 * 3 indices
+const std::vector<glm::vec3> ship_vertices = {
+		{0.f, 0.f, 1.f},
+		{-1.f, 0.f, -1.f},
+		{1.f, 0.f, -1.f},
+
+		{0.f, 0.f, 1.f},
+		{-1.f, 1.f, -1.f},
+		{1.f, 1.f, -1.f},
+
+		{0.f, 0.f, 1.f},
+		{-1.f, 0.f, -1.f},
+		{-1.f, 1.f, -1.f},
+
+		{0.f, 0.f, 1.f},
+		{1.f, 0.f, -1.f},
+		{1.f, 1.f, -1.f},
+};
+
+namespace {
+
+// Scale ship_model_matrix applies to the mesh
+const float ship_scale = 0.5f;
+
+float mesh_radius(const std::vector<glm::vec3> & vertices, float scale)
+{
+	float radius = 0;
+	for (const glm::vec3 & v : vertices)
+		radius = std::max(radius, glm::length(v));
+	return radius * scale;
+}
+
+std::vector<glm::vec3> face_normals(const std::vector<glm::vec3> & vertices)
+{
+	std::vector<glm::vec3> normals;
+	for (size_t i = 0; i + 2 < vertices.size(); i += 3)
+		normals.push_back(glm::normalize(glm::cross(vertices[i + 1] - vertices[i], vertices[i + 2] - vertices[i])));
+	return normals;
+}
+
+// the 4 triangles of ship_vertices
+const size_t ship_faces = 4;
+const std::vector<glm::vec3> ship_face_normals = face_normals(ship_vertices);
+
+}
+
+const float ship_bounding_radius = mesh_radius(ship_vertices, ship_scale);
+
+namespace {
+
+const double orbit_period = 10;
+// the orbit plane is tilted around X by this angle
+const double orbit_tilt = M_PI_4;
+const double orbit_tilt_sin = sin(orbit_tilt);
+const double orbit_tilt_cos = cos(orbit_tilt);
+
+}
+
+// Position on the tilted circular orbit every flyer follows.
+// t is the simulation time in seconds, r the orbit radius.
+glm::vec3 orbit_position(double t, double delta_theta, double r)
+{
+	double theta = 2 * M_PI * t / orbit_period + delta_theta;// angle
+
+	// the circle (r cos, 0, r sin) rotated around X by orbit_tilt
+	double x = r * cos(theta);
+	double z = r * sin(theta);
+
+	return glm::vec3{float(x), float(orbit_tilt_sin * z), float(orbit_tilt_cos * z)};
+}
+
+size_t add_orbit(TrajectorySet & trajectories, double delta_theta, double r)
+{
+	const glm::vec3 u(1, 0, 0);
+	const glm::vec3 v(0, orbit_tilt_sin, orbit_tilt_cos);
+	return trajectories.add_circle(glm::vec3(0, 0, 0), u, v, float(r), orbit_period, delta_theta);
+}
+
+glm::vec3 orbit_velocity(double t, double delta_theta, double r)
+{
+	const double omega = 2 * M_PI / orbit_period;
+	double theta = omega * t + delta_theta;
+
+	double x = -r * omega * sin(theta);
+	double z = r * omega * cos(theta);
+
+	return glm::vec3{float(x), float(orbit_tilt_sin * z), float(orbit_tilt_cos * z)};
+}
+
+glm::quat ship_orientation(const glm::vec3 & heading)
+{
+	if (glm::dot(heading, heading) == 0)
+		return glm::quat();
+
+	// yaw the nose around Y into the heading's vertical plane, then pitch it up or down
+	const glm::vec3 forward(0, 0, 1);
+	const glm::vec3 level(heading.x, 0, heading.z);
+	if (glm::dot(level, level) < 1e-12f * glm::dot(heading, heading))
+		return RotationBetweenVectors(forward, heading);
+
+	// RotationBetweenVectors only approximates turns close to half a turn,
+	// so a heading towards -Z is reached by a half turn around Y first
+	glm::quat yaw;
+	if (level.z >= 0)
+		yaw = RotationBetweenVectors(forward, level);
+	else
+		yaw = RotationBetweenVectors(-forward, level) * glm::quat(0, 0, 1, 0);
+
+	return RotationBetweenVectors(level, heading) * yaw;
+}
+
+glm::mat4 ship_model_matrix(const glm::vec3 & position, const glm::quat & orientation)
+{
+	// uniform scale commutes with the rotation, so both fold into the 3x3 part
+	const glm::mat3 rotation = glm::mat3_cast(orientation);
+
+	return glm::mat4(
+			glm::vec4(rotation[0] * ship_scale, 0),
+			glm::vec4(rotation[1] * ship_scale, 0),
+			glm::vec4(rotation[2] * ship_scale, 0),
+			glm::vec4(position, 1));
+}
+
+glm::mat4 ship_model_matrix(const glm::vec3 & position, const glm::vec3 & heading)
+{
+	return ship_model_matrix(position, ship_orientation(heading));
+}
+
+void ship_screen_points(const ProjectedVertices & projected, cv::Point * points)
+{
+	// integer pixel positions, truncated like the original cv::Point2i conversion
+	for (size_t i = 0; i < projected.size(); ++i)
+		points[i] = cv::Point(int(projected.x[i]), int(projected.y[i]));
+}
+
+void draw_ship_edges(TileRasterizer & raster, const cv::Point * points, const unsigned char * visible, size_t count,
+		const glm::vec3 & color)
+{
+	cv::Scalar clr{
+		255 * color[2],
+		255 * color[1],
+		255 * color[0]}
+		;
+
+	raster.begin_lines(clr, 2);
+	for (size_t i = 0; i < count; i += 3){
+		for (size_t j = 0; j < 3; ++j){
+			size_t idx1 = i + j;
+			size_t idx2 = i + (j + 1) % 3;
+
+			if (!visible[idx1] or !visible[idx2])
+				continue;
+
+			raster.add_line(float(points[idx1].x), float(points[idx1].y), float(points[idx2].x), float(points[idx2].y));
+		}
+	}
+
+	// radius 3 covers a 2 px wide circle of radius 2
+	raster.begin_markers({255, 0, 0}, 3);
+	for (size_t i = 0; i < count; ++i){
+		if (visible[i])
+			raster.add_marker(points[i]);
+	}
+}
+
+void setup_ship_faces(const ProjectedVertices & projected, const glm::mat4 & ModelView, const glm::vec3 & color,
+		int width, int height, std::vector<TriangleSetup> & faces)
+{
+	// flat shading, lit from the camera: faces turned to it are brightest.
+	// Both sides are lit, as the GL path does not cull them either.
+	// ModelView only rotates and scales uniformly, so it turns normals too.
+	cv::Scalar colors[ship_faces];
+	for (size_t i = 0; i < ship_faces; ++i){
+		const glm::vec3 n = glm::normalize(glm::mat3(ModelView) * ship_face_normals[i]);
+		const float shade = 0.35f + 0.65f * fabsf(n.z);
+		colors[i] = cv::Scalar(255 * color[2] * shade, 255 * color[1] * shade, 255 * color[0] * shade);
+	}
+
+	setup_triangles(projected, colors, width, height, faces);
+}
+
+void cull_drawables(
+	const std::vector<std::unique_ptr<Drawable>> & objects,
+	const glm::mat4 & ViewMatrix,
+	const glm::mat4 & ProjectionMatrix,
+	std::vector<unsigned char> & visible,
+	CullStats & stats
+){
+	const Frustum frustum(ProjectionMatrix * ViewMatrix);
+
+	visible.resize(objects.size());
+	for (size_t i = 0; i < objects.size(); ++i){
+		BoundingSphere sphere;
+		visible[i] = not objects[i]->bounds(sphere) or frustum.intersects(sphere);
+		stats.add(visible[i]);
+	}
+}
+
+bool pick_drawable(
+	const std::vector<std::unique_ptr<Drawable>> & objects,
+	const Ray & ray,
+	size_t & object,
+	size_t & instance,
+	float & t
+){
+	bool hit = false;
+	for (size_t i = 0; i < objects.size(); ++i){
+		float d;
+		size_t k;
+		if (objects[i]->raycast(ray, d, k) and (not hit or d < t)){
+			object = i;
+			instance = k;
+			t = d;
+			hit = true;
+		}
+	}
+	return hit;
+}
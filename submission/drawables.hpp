@@ -0,0 +1,822 @@
+#ifndef DRAWABLES_HPP
+#define DRAWABLES_HPP
+
+#include <vector>
+#include <memory>
+#include <set>
+#include <utility>
+#include <algorithm>
+#include <math.h>
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <opencv2/opencv.hpp>
+
+#include <common/shader.hpp>
+#include <common/sim_clock.hpp>
+#include <common/projection.hpp>
+#include <common/render_queue.hpp>
+#include <common/line_clipper.hpp>
+#include <common/frame_uniforms.hpp>
+#include <common/frustum.hpp>
+#include <common/gl_state.hpp>
+#include <common/ground_grid.hpp>
+#include <common/bvh.hpp>
+#include <common/trajectories.hpp>
+#include <common/thread_pool.hpp>
+#include <common/task_graph.hpp>
+#include <common/tile_rasterizer.hpp>
+
+// Scene objects of the flyers demo. Each one draws either through OpenGL
+// or, when constructed without GL, into a TileRasterizer for the cv::Mat path.
+
+class Drawable
+{
+public:
+	// Advance the object to clock.now(); called once per frame before any draw
+	virtual void update(const SimClock & clock){}
+
+	// GL path: stores the object's transforms for this frame; called for every
+	// visible object between begin_frame and commit, before any GL draw
+	virtual void prepare(FrameUniforms & uniforms){}
+
+	// GL path: submits the object's draw packets, drawn later by queue.execute()
+	// together with those of every other object
+	virtual void draw(const glm::mat4 & ViewMatrix, const glm::mat4 & ProjectionMatrix, RenderQueue & queue) = 0;
+	// Software path: records lines and circles for the frame in raster.frame_size()
+	virtual void draw(const glm::mat4 & ViewMatrix, const glm::mat4 & ProjectionMatrix, TileRasterizer & raster) = 0;
+
+	// Labels the object's draw stages in timing reports
+	virtual const char * name() const { return "Drawable"; }
+
+	// True when the software drawing only changes with the view, so it can be
+	// recorded into a cached StaticLayer instead of every frame
+	virtual bool is_static() const { return false; }
+
+	// World space sphere around everything the object draws at its current
+	// state; false for objects that are never culled
+	virtual bool bounds(BoundingSphere & sphere) const { return false; }
+
+	// Adds the counters of any culling done inside the object itself
+	virtual void add_cull_stats(CullStats & stats) const {}
+
+	// Closest hit of the ray at distance t; instance tells flyers of one object apart
+	virtual bool raycast(const Ray & ray, float & t, size_t & instance) const { return false; }
+
+	virtual ~Drawable(){}
+};
+
+// Ground grid of any extent, drawn chunk by chunk as GroundGrid picks them
+// for the view. The GL path draws one shared unit chunk mesh per chunk, or
+// with generated = true builds the lines from gl_VertexID without any vertex
+// buffer. The cv::Mat path clips the lines of the picked chunks and marks the
+// vertices of the finest ones.
+class Grid : public Drawable
+{
+	GLuint vao;
+	GLuint vbo;
+
+	GLuint programID;
+	GLint ChunkID;
+	GLint GridColorID;
+	GLint GeneratedID;
+
+	const GroundGrid ground;
+	// chunks picked for the last view
+	std::vector<GridChunk> chunks;
+
+	// cv::Mat path: line ends and vertex markers of the picked chunks in SoA
+	// form, the lines between them and the reused projection and clipping output
+	VertexArraySoA vertices_soa;
+	VertexArraySoA markers_soa;
+	std::vector<LineSegment> edges;
+	ProjectedVertices projected;
+	ProjectedVertices projected_markers;
+	ClippedSegments clipped;
+
+	glm::vec3 color = {0, 1, 0};
+
+	// false when constructed for the headless (cv::Mat only) path
+	const bool with_gl;
+	// GL lines come from gl_VertexID instead of a vertex buffer
+	const bool generated;
+
+	void select_chunks(const glm::mat4 & ViewMatrix, const glm::mat4 & ProjectionMatrix)
+	{
+		ground.select(view_eye(ViewMatrix), Frustum(ProjectionMatrix * ViewMatrix), chunks);
+	}
+
+public:
+
+	const char * name() const override { return "Grid"; }
+
+	bool is_static() const override { return true; }
+
+	bool bounds(BoundingSphere & sphere) const override
+	{
+		sphere = ground.bounds();
+		return true;
+	}
+
+	// extent x extent world units centered on the origin, a line every spacing units
+	Grid(bool with_gl_ = true, float extent = 10, float spacing = 1, bool generated_ = false) :
+		ground(extent, spacing),
+		with_gl(with_gl_),
+		generated(generated_)
+	{
+		if (not with_gl)
+			return;
+
+		programID = LoadShaders(
+				"GridVertexShader.vertexshader",
+				"ColorFragmentShader.fragmentshader"
+		);
+
+		// VP comes from the FrameData block, everything else from per packet
+		// uniforms: LoadShaders shares the program with every other Grid
+		FrameUniforms::bind_block(programID);
+		ChunkID = glGetUniformLocation(programID, "Chunk");
+		GridColorID = glGetUniformLocation(programID, "GridColor");
+		GeneratedID = glGetUniformLocation(programID, "Generated");
+
+		// core profiles draw nothing without a vertex array, even an empty one
+		glGenVertexArrays(1, &vao);
+		gl_state().bind_vertex_array(vao);
+
+		if (not generated){
+			// unit chunk mesh: every line of constant x, then every line of constant z
+			const int n = GroundGrid::CHUNK_LINES;
+			std::vector<glm::vec2> mesh;
+			for (int i = 0; i < n; ++i){
+				mesh.push_back(glm::vec2(float(i) / (n - 1), 0));
+				mesh.push_back(glm::vec2(float(i) / (n - 1), 1));
+			}
+			for (int i = 0; i < n; ++i){
+				mesh.push_back(glm::vec2(0, float(i) / (n - 1)));
+				mesh.push_back(glm::vec2(1, float(i) / (n - 1)));
+			}
+
+			glGenBuffers(1, &vbo);
+			gl_state().bind_buffer(GL_ARRAY_BUFFER, vbo);
+			glBufferData(GL_ARRAY_BUFFER, mesh.size() * sizeof(glm::vec2), &mesh[0].x, GL_STATIC_DRAW);
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+		}
+
+		gl_state().bind_vertex_array(0);
+		gl_state().bind_buffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	void draw(const glm::mat4 & ViewMatrix, const glm::mat4 & ProjectionMatrix, RenderQueue & queue) override
+	{
+		select_chunks(ViewMatrix, ProjectionMatrix);
+
+		// two packets per chunk: its lines of constant x, then those of constant z
+		DrawPacket lines_x = RenderQueue::packet(programID, vao, GL_LINES, GL_LINE, true, 0, 0);
+		DrawPacket lines_z = RenderQueue::packet(programID, vao, GL_LINES, GL_LINE, true, 2 * GroundGrid::CHUNK_LINES, 0);
+		lines_x.int_location = lines_z.int_location = GeneratedID;
+		lines_x.int_value = lines_z.int_value = generated ? 1 : 0;
+		lines_x.vec4_locations[0] = lines_z.vec4_locations[0] = ChunkID;
+		lines_x.vec4_locations[1] = lines_z.vec4_locations[1] = GridColorID;
+		lines_x.vec4_values[1] = lines_z.vec4_values[1] = glm::vec4(color, 1);
+
+		for (const GridChunk & chunk : chunks){
+			lines_x.vec4_values[0] = lines_z.vec4_values[0] = glm::vec4(chunk.x, chunk.z, chunk.size, ground.high());
+			lines_x.count = 2 * chunk.lines_x;
+			lines_z.count = 2 * chunk.lines_z;
+			queue.submit(lines_x);
+			queue.submit(lines_z);
+		}
+	}
+
+	void draw(const glm::mat4 & ViewMatrix, const glm::mat4 & ProjectionMatrix, TileRasterizer & raster) override
+	{
+		const glm::mat4 VP = ProjectionMatrix * ViewMatrix;
+
+		select_chunks(ViewMatrix, ProjectionMatrix);
+
+		vertices_soa.clear();
+		markers_soa.clear();
+		edges.clear();
+
+		glm::vec3 a, b;
+		for (const GridChunk & chunk : chunks){
+			for (int i = 0; i < chunk.lines_x; ++i){
+				ground.line_x(chunk, i, a, b);
+				edges.push_back(LineSegment{unsigned(vertices_soa.size()), unsigned(vertices_soa.size() + 1)});
+				vertices_soa.push_back(a);
+				vertices_soa.push_back(b);
+			}
+			for (int i = 0; i < chunk.lines_z; ++i){
+				ground.line_z(chunk, i, a, b);
+				edges.push_back(LineSegment{unsigned(vertices_soa.size()), unsigned(vertices_soa.size() + 1)});
+				vertices_soa.push_back(a);
+				vertices_soa.push_back(b);
+			}
+
+			// vertex markers only where the lines are at their finest
+			if (chunk.level > 0)
+				continue;
+			for (int i = 0; i < chunk.lines_x; ++i)
+				for (int j = 0; j < chunk.lines_z; ++j)
+					markers_soa.push_back(ground.vertex(chunk, i, j));
+		}
+
+		const cv::Size size = raster.frame_size();
+
+		const cv::Scalar clr{
+			255 * color[2],
+			255 * color[1],
+			255 * color[0]
+		};
+
+		// lines crossing the near plane or the frame edges are shortened here
+		project_vertices(vertices_soa, VP, size.width, size.height, projected);
+		clip_segments(projected, edges, size.width, size.height, clipped);
+
+		raster.lines(clipped.x1.data(), clipped.y1.data(), clipped.x2.data(), clipped.y2.data(), clipped.size(), clr, 2);
+
+		project_vertices(markers_soa, VP, size.width, size.height, projected_markers);
+		raster.markers(projected_markers.x.data(), projected_markers.y.data(), projected_markers.visible.data(),
+				projected_markers.size(), {255, 0, 0}, 3);
+	}
+
+	virtual ~Grid()
+	{
+		if (not with_gl)
+			return;
+
+		if (not generated)
+			glDeleteBuffers(1, &vbo);
+		glDeleteVertexArrays(1, &vao);
+		ReleaseShaders(programID);
+		// deleted names may come back for new objects
+		gl_state().invalidate();
+	}
+};
+
+// Ship mesh: 4 triangles, 12 non indexed vertices
+extern const std::vector<glm::vec3> ship_vertices;
+
+// Radius around the ship origin that holds the mesh as ship_model_matrix scales it
+extern const float ship_bounding_radius;
+
+// Position on the tilted circular orbit every flyer follows.
+// t is the simulation time in seconds, r the orbit radius.
+glm::vec3 orbit_position(double t, double delta_theta, double r = 5);
+// Its derivative in units per second, tangent to the orbit
+glm::vec3 orbit_velocity(double t, double delta_theta, double r = 5);
+// Adds the same orbit to a batch of trajectories, returns its index there
+size_t add_orbit(TrajectorySet & trajectories, double delta_theta, double r);
+
+// Rotation of the ship mesh (nose +Z, wings in XZ) that points the nose
+// along heading and keeps the wings level; heading need not be normalized
+glm::quat ship_orientation(const glm::vec3 & heading);
+
+// Model matrix of a ship at position, turned by orientation
+glm::mat4 ship_model_matrix(const glm::vec3 & position, const glm::quat & orientation);
+// Model matrix of a ship at position, nose pointing along heading
+glm::mat4 ship_model_matrix(const glm::vec3 & position, const glm::vec3 & heading);
+
+// Pixel positions of projected ship vertices, one per vertex
+void ship_screen_points(const ProjectedVertices & projected, cv::Point * points);
+// Wireframe of one projected ship mesh plus its vertex markers; visible[i] as in ProjectedVertices
+void draw_ship_edges(TileRasterizer & raster, const cv::Point * points, const unsigned char * visible, size_t count,
+		const glm::vec3 & color);
+
+// Appends the filled, flat shaded faces of one projected ship mesh for a
+// width x height frame; ModelView places the ship relative to the camera.
+// Drawn under the wireframe when ships are filled.
+void setup_ship_faces(const ProjectedVertices & projected, const glm::mat4 & ModelView, const glm::vec3 & color,
+		int width, int height, std::vector<TriangleSetup> & faces);
+
+// Closest object the ray hits, and which of its instances; false for a miss
+bool pick_drawable(
+	const std::vector<std::unique_ptr<Drawable>> & objects,
+	const Ray & ray,
+	size_t & object,
+	size_t & instance,
+	float & t
+);
+
+// Frame level cull pass over the scene: visible[i] = 0 when the bounds of
+// objects[i] are outside the view volume of ProjectionMatrix * ViewMatrix
+void cull_drawables(
+	const std::vector<std::unique_ptr<Drawable>> & objects,
+	const glm::mat4 & ViewMatrix,
+	const glm::mat4 & ProjectionMatrix,
+	std::vector<unsigned char> & visible,
+	CullStats & stats
+);
+
+class Ship : public Drawable
+{
+	GLuint vao;
+	GLuint vertexbuffer;
+
+	GLuint programID;
+	GLint ObjectID;
+	// this frame's slot in the FrameUniforms buffer
+	int object_id = -1;
+
+	const double delta_theta;
+
+	GLuint colorbuffer;
+	const glm::vec3 color;
+
+	// false when constructed for the headless (cv::Mat only) path
+	const bool with_gl;
+	// cv::Mat path: depth tested faces under the wireframe
+	const bool filled;
+
+	const std::vector<glm::vec3> & vertices = ship_vertices;
+
+	// cv::Mat path: vertices in SoA form, the reused projection output and faces
+	const VertexArraySoA vertices_soa = VertexArraySoA(vertices);
+	ProjectedVertices projected;
+	std::vector<cv::Point> points = std::vector<cv::Point>(vertices.size());
+	std::vector<TriangleSetup> faces;
+
+public:
+
+	const char * name() const override { return "Ship"; }
+
+	bool bounds(BoundingSphere & sphere) const override
+	{
+		sphere = BoundingSphere{curr_pos, ship_bounding_radius};
+		return true;
+	}
+
+	bool raycast(const Ray & ray, float & t, size_t & instance) const override
+	{
+		instance = 0;
+		return intersect_ray_sphere(ray, curr_pos, ship_bounding_radius, t);
+	}
+
+	Ship(glm::vec3 color_, double delta_theta_, bool with_gl_ = true, bool filled_ = false) :
+		delta_theta(delta_theta_), color(color_), with_gl(with_gl_), filled(filled_)
+	{
+		if (not with_gl)
+			return;
+
+		programID = LoadShaders(
+			"TransformVertexShader.vertexshader",
+			"ColorFragmentShader.fragmentshader"
+		);
+
+		// transforms come from the FrameData block, indexed by "ObjectID"
+		FrameUniforms::bind_block(programID);
+		ObjectID = glGetUniformLocation(programID, "ObjectID");
+
+		glGenVertexArrays(1, &vao);
+		gl_state().bind_vertex_array(vao);
+
+		const GLfloat g_color_buffer_data[] = {
+				color[0], color[1], color[2],
+				color[0], color[1], color[2],
+				color[0], color[1], color[2],
+
+				color[0], color[1], color[2],
+				color[0], color[1], color[2],
+				color[0], color[1], color[2],
+
+				color[0], color[1], color[2],
+				color[0], color[1], color[2],
+				color[0], color[1], color[2],
+
+				color[0], color[1], color[2],
+				color[0], color[1], color[2],
+				color[0], color[1], color[2],
+		};
+
+// This will identify our vertex buffer
+//		GLuint vertexbuffer;
+// Generate 1 buffer, put the resulting identifier in vertexbuffer
+		glGenBuffers(1, &vertexbuffer);
+// The following commands will talk about our 'vertexbuffer' buffer
+		gl_state().bind_buffer(GL_ARRAY_BUFFER, vertexbuffer);
+// Give our vertices to OpenGL.
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), glm::value_ptr(vertices[0]), GL_STATIC_DRAW);
+		// 1rst attribute buffer : vertices
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(
+				0,                  // attribute. No particular reason for 0, but must match the layout in the shader.
+				3,                  // size
+				GL_FLOAT,           // type
+				GL_FALSE,           // normalized?
+				0,                  // stride
+				(void*)0            // array buffer offset
+		);
+
+		glGenBuffers(1, &colorbuffer);
+		gl_state().bind_buffer(GL_ARRAY_BUFFER, colorbuffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(g_color_buffer_data), g_color_buffer_data, GL_STATIC_DRAW);
+		// 2nd attribute buffer : colors
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(
+				1,                                // attribute. No particular reason for 1, but must match the layout in the shader.
+				3,                                // size
+				GL_FLOAT,                         // type
+				GL_FALSE,                         // normalized?
+				0,                                // stride
+				(void*)0                          // array buffer offset
+		);
+
+		gl_state().bind_vertex_array(0);
+		gl_state().bind_buffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	// t is the simulation time in seconds
+	glm::vec3 calc_position(double t)
+	{
+		return orbit_position(t, delta_theta);
+	}
+
+
+	// pose at the last tick, shared by the GL and the software draw;
+	// the nose follows the orbit tangent, so it needs no previous position
+	glm::vec3 curr_pos = calc_position(0);
+	glm::quat orientation = ship_orientation(orbit_velocity(0, delta_theta));
+	glm::mat4 model = ship_model_matrix(curr_pos, orientation);
+
+	void update(const SimClock & clock) override
+	{
+		const double t = clock.now();
+		curr_pos = calc_position(t);
+		orientation = ship_orientation(orbit_velocity(t, delta_theta));
+		model = ship_model_matrix(curr_pos, orientation);
+	}
+
+	// Model-view-projection of the ship's current model matrix, for the
+	// cv::Mat path; GL draws read the model from FrameUniforms instead
+	glm::mat4 calcMVP(const glm::mat4 & ViewMatrix, const glm::mat4 & ProjectionMatrix){
+		const glm::mat4 & ModelMatrix = model;
+
+		glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
+		return MVP;
+	}
+
+
+
+	void prepare(FrameUniforms & uniforms) override
+	{
+		object_id = uniforms.add_object(model);
+	}
+
+	void draw(const glm::mat4 & ViewMatrix, const glm::mat4 & ProjectionMatrix, RenderQueue & queue) override
+	{
+		if (object_id < 0)
+			return;
+
+		// the MVP parts are already in this frame's uniform buffer
+		DrawPacket packet = RenderQueue::packet(programID, vao, GL_TRIANGLES, GL_LINE, true, 0, GLsizei(vertices.size()));
+		packet.int_location = ObjectID;
+		packet.int_value = object_id;
+		queue.submit(packet);
+	}
+
+	void draw(const glm::mat4 & ViewMatrix, const glm::mat4 & ProjectionMatrix, TileRasterizer & raster) override
+	{
+		glm::mat4 MVP = calcMVP(ViewMatrix, ProjectionMatrix);
+
+		cv::Size size = raster.frame_size();
+
+		project_vertices(vertices_soa, MVP, size.width, size.height, projected);
+		if (filled){
+			faces.clear();
+			setup_ship_faces(projected, ViewMatrix * model, color, size.width, size.height, faces);
+			raster.triangles(faces.data(), faces.size());
+		}
+		ship_screen_points(projected, points.data());
+		draw_ship_edges(raster, points.data(), projected.visible.data(), projected.size(), color);
+	}
+
+
+	virtual ~Ship()
+	{
+		if (not with_gl)
+			return;
+
+		glDeleteBuffers(1, &vertexbuffer);
+		glDeleteBuffers(1, &colorbuffer);
+		glDeleteVertexArrays(1, &vao);
+		ReleaseShaders(programID);
+		// deleted names may come back for new objects
+		gl_state().invalidate();
+	}
+};
+
+// Any number of ships sharing one mesh, one program and one VAO.
+// Per flyer model matrices and colors live in instanced attribute buffers,
+// so the whole fleet is a single glDrawArraysInstanced call.
+class Fleet : public Drawable
+{
+	GLuint vao;
+	GLuint vertexbuffer;
+	GLuint colorbuffer;
+	GLuint modelbuffer;
+
+	GLuint programID;
+
+	// false when constructed for the headless (cv::Mat only) path
+	const bool with_gl;
+	// cv::Mat path: depth tested faces under the wireframe
+	const bool filled;
+
+	// spreads the per flyer work over its threads; nullptr keeps it on the caller
+	ThreadPool * const pool;
+	// flyers per parallel task
+	static const size_t FLYER_GRAIN = 256;
+
+	// update: evaluate the trajectories, then orient the flyers and refit the
+	// hierarchy side by side, as both only read the new positions
+	TaskGraph update_graph;
+	double update_time = 0;
+
+	// per flyer orbits, evaluated for the whole fleet at once, and state
+	TrajectorySet trajectories;
+	std::vector<glm::vec3> colors;
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> velocities;
+	std::vector<glm::quat> orientations;
+	std::vector<glm::mat4> models;
+
+	// hierarchy over positions, refit every update
+	SphereBvh bvh;
+
+	// instances inside the last culled view, compacted for drawing
+	std::vector<unsigned> visible_items;
+	std::vector<glm::mat4> visible_models;
+	std::vector<glm::vec3> visible_colors;
+	glm::mat4 culled_VP;
+	bool cull_valid = false;
+	CullStats instance_stats;
+
+	float bounding_radius = 0;
+
+	// cv::Mat path: vertices in SoA form, projection scratch and faces per
+	// parallel chunk, and the screen points of every visible flyer
+	const VertexArraySoA vertices_soa = VertexArraySoA(ship_vertices);
+	std::vector<ProjectedVertices> projected;
+	std::vector<std::vector<TriangleSetup>> faces;
+	std::vector<cv::Point> instance_points;
+	std::vector<unsigned char> instance_visible;
+
+	// Calls fn on ranges covering [0, count), in parallel when there is a pool
+	void for_ranges(size_t count, const std::function<void(size_t, size_t)> & fn)
+	{
+		if (pool)
+			pool->parallel_for_ranges(count, FLYER_GRAIN, fn);
+		else
+			fn(0, count);
+	}
+
+	// Culls every flyer against VP once per update and view, so the GL and
+	// the software draw of one frame share the pass and count it once
+	void cull(const glm::mat4 & VP)
+	{
+		if (cull_valid and VP == culled_VP)
+			return;
+
+		bvh.query_frustum(Frustum(VP), visible_items);
+		// keep the draw order of the flyers independent of the tree layout
+		std::sort(visible_items.begin(), visible_items.end());
+
+		visible_models.resize(visible_items.size());
+		visible_colors.resize(visible_items.size());
+		for_ranges(visible_items.size(), [this](size_t begin, size_t end){
+			for (size_t j = begin; j < end; ++j){
+				visible_models[j] = models[visible_items[j]];
+				visible_colors[j] = colors[visible_items[j]];
+			}
+		});
+
+		instance_stats.visible += visible_items.size();
+		instance_stats.culled += models.size() - visible_items.size();
+
+		culled_VP = VP;
+		cull_valid = true;
+	}
+
+	// Positions and analytic orbit tangents of every flyer at time t, in one batch
+	void fly(double t)
+	{
+		trajectories.evaluate(t, positions, velocities, pool);
+	}
+
+	// Orientations and model matrices from the last fly()
+	void orient()
+	{
+		orientations.resize(positions.size());
+		models.resize(positions.size());
+		for_ranges(positions.size(), [this](size_t begin, size_t end){
+			for (size_t i = begin; i < end; ++i){
+				orientations[i] = ship_orientation(velocities[i]);
+				models[i] = ship_model_matrix(positions[i], orientations[i]);
+			}
+		});
+	}
+
+public:
+
+	const char * name() const override { return "Fleet"; }
+
+	// every orbit is centered on the origin
+	bool bounds(BoundingSphere & sphere) const override
+	{
+		sphere = BoundingSphere{glm::vec3(0, 0, 0), bounding_radius};
+		return true;
+	}
+
+	void add_cull_stats(CullStats & stats) const override
+	{
+		stats.visible += instance_stats.visible;
+		stats.culled += instance_stats.culled;
+	}
+
+	bool raycast(const Ray & ray, float & t, size_t & instance) const override
+	{
+		unsigned item;
+		if (not bvh.raycast(ray, item, t))
+			return false;
+		instance = item;
+		return true;
+	}
+
+	// Flyers whose bounds reach within r of center
+	void query_radius(const glm::vec3 & center, float r, std::vector<unsigned> & out) const
+	{
+		bvh.query_radius(center, r, out);
+	}
+
+	const glm::vec3 & position(size_t i) const { return positions[i]; }
+
+	// Spreads count flyers over orbits of radius 2 to 8 with evenly spaced phases
+	Fleet(size_t count, bool with_gl_ = true, ThreadPool * pool_ = nullptr, bool filled_ = false) :
+		with_gl(with_gl_), filled(filled_), pool(pool_)
+	{
+		for (size_t i = 0; i < count; ++i){
+			// golden ratio sequence, so neighbours in phase get distant radii and hues
+			const double f = fmod(i * 0.618033988749895, 1.0);
+
+			const double delta_theta = 2 * M_PI * i / count;
+			const double radius = 2 + 6 * f;
+			add_orbit(trajectories, delta_theta, radius);
+			colors.push_back(glm::vec3(1, f, 1 - f));
+
+			bounding_radius = std::max(bounding_radius, float(radius) + ship_bounding_radius);
+		}
+
+		fly(0);
+		orient();
+		bvh.build(positions, ship_bounding_radius);
+
+		const TaskGraph::Node fly_node = update_graph.add([this]{ fly(update_time); });
+		const TaskGraph::Node orient_node = update_graph.add([this]{ orient(); });
+		const TaskGraph::Node refit_node = update_graph.add([this]{ bvh.refit(positions); });
+		update_graph.precede(fly_node, orient_node);
+		update_graph.precede(fly_node, refit_node);
+
+		visible_items.reserve(count);
+		visible_models.reserve(count);
+		visible_colors.reserve(count);
+
+		if (not with_gl)
+			return;
+
+		programID = LoadShaders(
+			"FleetVertexShader.vertexshader",
+			"ColorFragmentShader.fragmentshader"
+		);
+
+		// VP comes from the FrameData block
+		FrameUniforms::bind_block(programID);
+
+		glGenVertexArrays(1, &vao);
+		gl_state().bind_vertex_array(vao);
+
+		// 1rst attribute buffer : shared mesh vertices
+		glGenBuffers(1, &vertexbuffer);
+		gl_state().bind_buffer(GL_ARRAY_BUFFER, vertexbuffer);
+		glBufferData(GL_ARRAY_BUFFER, ship_vertices.size() * sizeof(glm::vec3), glm::value_ptr(ship_vertices[0]), GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+
+		// 2nd attribute buffer : one color per visible instance, rewritten with the models
+		glGenBuffers(1, &colorbuffer);
+		gl_state().bind_buffer(GL_ARRAY_BUFFER, colorbuffer);
+		glBufferData(GL_ARRAY_BUFFER, colors.size() * sizeof(glm::vec3), nullptr, GL_STREAM_DRAW);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+		glVertexAttribDivisor(1, 1);
+
+		// 3rd attribute buffer : one model matrix per visible instance, rewritten every frame
+		glGenBuffers(1, &modelbuffer);
+		gl_state().bind_buffer(GL_ARRAY_BUFFER, modelbuffer);
+		glBufferData(GL_ARRAY_BUFFER, models.size() * sizeof(glm::mat4), nullptr, GL_STREAM_DRAW);
+		for (GLuint column = 0; column < 4; ++column){
+			glEnableVertexAttribArray(2 + column);
+			glVertexAttribPointer(2 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(column * sizeof(glm::vec4)));
+			glVertexAttribDivisor(2 + column, 1);
+		}
+
+		gl_state().bind_vertex_array(0);
+		gl_state().bind_buffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	size_t size() const { return models.size(); }
+
+	void update(const SimClock & clock) override
+	{
+		update_time = clock.now();
+		update_graph.run(pool);
+		cull_valid = false;
+	}
+
+	void draw(const glm::mat4 & ViewMatrix, const glm::mat4 & ProjectionMatrix, RenderQueue & queue) override
+	{
+		const glm::mat4 VP = ProjectionMatrix * ViewMatrix;
+
+		cull(VP);
+		if (visible_models.empty())
+			return;
+
+		// Orphan last frame's storage so the upload does not wait for the GPU
+		const size_t visible = visible_models.size();
+
+		gl_state().bind_buffer(GL_ARRAY_BUFFER, modelbuffer);
+		glBufferData(GL_ARRAY_BUFFER, models.size() * sizeof(glm::mat4), nullptr, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, visible * sizeof(glm::mat4), &visible_models[0][0][0]);
+
+		gl_state().bind_buffer(GL_ARRAY_BUFFER, colorbuffer);
+		glBufferData(GL_ARRAY_BUFFER, colors.size() * sizeof(glm::vec3), nullptr, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, visible * sizeof(glm::vec3), glm::value_ptr(visible_colors[0]));
+
+		DrawPacket packet = RenderQueue::packet(programID, vao, GL_TRIANGLES, GL_LINE, true, 0, (GLsizei)ship_vertices.size());
+		packet.instances = (GLsizei)visible;
+		queue.submit(packet);
+	}
+
+	void draw(const glm::mat4 & ViewMatrix, const glm::mat4 & ProjectionMatrix, TileRasterizer & raster) override
+	{
+		const glm::mat4 VP = ProjectionMatrix * ViewMatrix;
+		const cv::Size size = raster.frame_size();
+
+		cull(VP);
+
+		// project in parallel, one scratch per chunk, then record in flyer
+		// order: the faces of every flyer first, the wireframes over them
+		const size_t n = visible_models.size();
+		const size_t stride = vertices_soa.size();
+		const size_t chunks = std::min(n, size_t(pool ? 4 * pool->size() : 1));
+		projected.resize(std::max(projected.size(), chunks));
+		faces.resize(std::max(faces.size(), chunks));
+		instance_points.resize(n * stride);
+		instance_visible.resize(n * stride);
+
+		auto project = [&](size_t chunk){
+			ProjectedVertices & scratch = projected[chunk];
+			std::vector<TriangleSetup> & chunk_faces = faces[chunk];
+			chunk_faces.clear();
+			for (size_t i = chunk * n / chunks; i < (chunk + 1) * n / chunks; ++i){
+				project_vertices(vertices_soa, VP * visible_models[i], size.width, size.height, scratch);
+				if (filled)
+					setup_ship_faces(scratch, ViewMatrix * visible_models[i], visible_colors[i], size.width, size.height, chunk_faces);
+				ship_screen_points(scratch, &instance_points[i * stride]);
+				std::copy(scratch.visible.begin(), scratch.visible.begin() + stride, instance_visible.begin() + i * stride);
+			}
+		};
+		if (pool)
+			pool->parallel_for(chunks, project);
+		else
+			for (size_t chunk = 0; chunk < chunks; ++chunk)
+				project(chunk);
+
+		if (filled)
+			for (size_t chunk = 0; chunk < chunks; ++chunk)
+				raster.triangles(faces[chunk].data(), faces[chunk].size());
+		for (size_t i = 0; i < n; ++i)
+			draw_ship_edges(raster, &instance_points[i * stride], &instance_visible[i * stride], stride, visible_colors[i]);
+	}
+
+	virtual ~Fleet()
+	{
+		if (not with_gl)
+			return;
+
+		glDeleteBuffers(1, &vertexbuffer);
+		glDeleteBuffers(1, &colorbuffer);
+		glDeleteBuffers(1, &modelbuffer);
+		glDeleteVertexArrays(1, &vao);
+		ReleaseShaders(programID);
+		// deleted names may come back for new objects
+		gl_state().invalidate();
+	}
+};
+
+#endif
@@ -1,6 +1,7 @@
 // Include standard headers
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 // Include GLEW
 #include <GL/glew.h>
@@ -19,12 +20,28 @@ using namespace glm;
 #include <common/shader.hpp>
 #include <common/texture.hpp>
 #include <common/controls.hpp>
+#include <common/sim_clock.hpp>
+#include <common/projection.hpp>
+#include <common/thread_pool.hpp>
+#include <common/tile_rasterizer.hpp>
+#include <common/frame_pool.hpp>
+#include <common/gpu_readback.hpp>
+#include <common/static_layer.hpp>
+#include <common/frame_uniforms.hpp>
+#include <common/render_queue.hpp>
+#include <common/gl_state.hpp>
+#include <common/render_pipeline.hpp>
+#include <common/video_output.hpp>
+#include <common/stage_timers.hpp>
+
+#include "drawables.hpp"
 
 #include <vector>
 #include <memory>
 #include <glm/gtc/type_ptr.hpp>
 #include <iostream>
 #include <chrono>
+#include <string>
 
 #include <opencv2/opencv.hpp>
 
@@ -50,573 +67,476 @@ std::ostream& operator << (std::ostream& os, const glm::mat4 & v){
 	return os;
 }
 
-class Drawable
-{
-public:
-	virtual void draw(const glm::mat4 & ViewMatrix, const glm::mat4 & ProjectionMatrix) = 0;
-	virtual void draw(const glm::mat4 & ViewMatrix, const glm::mat4 & ProjectionMatrix, cv::Mat & frame) = 0;
 
-	virtual ~Drawable(){}
-};
 
-class Grid : public Drawable
+mat4 LookAtRH(vec3 eye, vec3 target, vec3 up )
 {
-	GLuint vao;
-	GLuint vbo;
-	GLuint ibo;
-	GLuint colorbuffer;
-	int slices = 10;
-	int lenght;
-
-	GLuint programID;
-	GLuint MatrixID;
+	vec3 zaxis = glm::normalize(eye - target);    // The "forward" vector.
+	vec3 xaxis = glm::normalize(glm::cross(up, zaxis));// The "right" vector.
+	vec3 yaxis = glm::cross(zaxis, xaxis);     // The "up" vector.
 
-	std::vector<glm::vec3> vertices;
-	std::vector<glm::uvec4> indices;
+	// Create a 4x4 orientation matrix from the right, up, and forward vectors
+	// This is transposed which is equivalent to performing an inverse
+	// if the matrix is orthonormalized (in this case, it is).
+	mat4 orientation = {
+			vec4( xaxis.x, yaxis.x, zaxis.x, 0 ),
+			vec4( xaxis.y, yaxis.y, zaxis.y, 0 ),
+			vec4( xaxis.z, yaxis.z, zaxis.z, 0 ),
+			vec4(   0,       0,       0,     1 )
+	};
 
-	glm::vec3 color = {0, 1, 0};
+	// Create a 4x4 translation matrix.
+	// The eye position is negated which is equivalent
+	// to the inverse of the translation matrix.
+	// T(v)^-1 == T(-v)
+	mat4 translation = {
+			vec4(   1,      0,      0,   0 ),
+			vec4(   0,      1,      0,   0 ),
+			vec4(   0,      0,      1,   0 ),
+			vec4(-eye.x, -eye.y, -eye.z, 1 )
+	};
 
-public:
+	// Combine the orientation and translation to compute
+	// the final view matrix. Note that the order of
+	// multiplication is reversed because the matrices
+	// are already inverted.
+	return orientation * translation;
+}
 
-	Grid()
-	{
-		programID = LoadShaders(
-				"TransformVertexShader.vertexshader",
-				"ColorFragmentShader.fragmentshader"
-		);
-
-		// Get a handle for our "MVP" uniform
-		MatrixID = glGetUniformLocation(programID, "MVP");
-
-		glGenVertexArrays(1, &vao);
-		glBindVertexArray(vao);
-
-		for(int j = 0; j <= slices; ++j) {
-			for(int i = 0; i <= slices; ++i) {
-				float x = (float) i / (float) slices;
-				float y = 0;
-				float z = (float) j / (float) slices;
-				vertices.push_back(glm::vec3(x, y, z));
-			}
-		}
 
-		// Add the line segments
-		for(int j = 0; j < slices; ++j) {
-			for(int i = 0; i < slices; ++i) {
-
-				int row1 =  j * (slices + 1);
-				int row2 = (j + 1) * (slices + 1);
-
-				indices.push_back(glm::uvec4(
-						row1 + i,
-						row1 + i + 1,
-						row1 + i + 1,
-						row2 + i + 1
-						));
-
-				indices.push_back(glm::uvec4(
-						row2 + i + 1,
-						row2 + i,
-						row2 + i,
-						row1 + i
-						));
-			}
-		}
+struct Options
+{
+	bool headless = false;
+	int frames = 600;           // headless only; 0 renders forever
+	int width = 1024;
+	int height = 768;
+	const char * output_dir = nullptr; // headless only; frames are discarded when null
+	double time_step = 0;       // fixed simulation step per frame, seconds
+	double time_scale = 0;      // simulation speed relative to wall time
+	int fleet = 0;              // flyers drawn through one instanced Fleet
+	double grid_extent = 10;    // side of the ground grid, world units
+	double grid_spacing = 1;    // distance between grid lines, world units
+	bool grid_shader = false;   // GL grid lines generated in the vertex shader
+	bool fill_ships = false;    // software ships get shaded faces under their wireframe
+	const char * shader_cache = nullptr; // directory of cached program binaries
+	int threads = 0;            // worker threads, 0 = every core
+	bool pin_threads = false;   // bind the worker threads to cores
+	bool readback = false;      // show the GL frames through OpenCV
+	bool software = true;       // windowed mode also records and rasterizes the OpenCV frames
+	int readback_frames = 3;    // frames in flight between GL rendering and readback
+	int pipeline_depth = 2;     // frames in flight between the render, raster and display stages
+	QueuePolicy queue_policy = QueuePolicy::DROP;
+	bool queue_policy_given = false;
+	const char * record = nullptr; // video target, see VideoOutput
+	double record_fps = 60;
+	const char * timings = nullptr; // CSV file of per-stage timings
+	int timings_every = 0;      // frames between CSV dumps, 0 = only on exit
+};
 
-		std::vector<glm::vec3> colors;
+void print_usage(const char * argv0)
+{
+	fprintf(stderr,
+			"Usage: %s [options]\n"
+			"  --headless        render through the OpenCV path only, without GLFW/GLEW\n"
+			"  --frames N        number of frames to render in headless mode (0 = forever)\n"
+			"  --size WxH        frame size in pixels (default 1024x768)\n"
+			"  --output DIR      write headless frames as DIR/frame_NNNNNN.png\n"
+			"  --time-step DT    advance the simulation by DT seconds per frame\n"
+			"                    (default in headless mode: 1/60)\n"
+			"  --time-scale K    run the simulation at K times wall-clock speed\n"
+			"  --fleet N         add N instanced flyers to the scene\n"
+			"  --grid-extent E   side of the ground grid in world units (default 10)\n"
+			"  --grid-spacing S  distance between grid lines (default 1)\n"
+			"  --grid-shader     generate the GL grid lines in the vertex shader, without a vertex buffer\n"
+			"  --fill-ships      fill the ships of the OpenCV path with depth tested, shaded faces\n"
+			"                    under the wireframe (drawn over the grid, not tested against it)\n"
+			"  --shader-cache DIR  keep linked program binaries in DIR (default: .)\n"
+			"  --threads N       threads for simulation, culling, projection and rasterization\n"
+			"                    (default: every core)\n"
+			"  --pin-threads     bind every worker thread to its own core\n"
+			"  --readback [N]    read GL frames back asynchronously and show them in OpenCV,\n"
+			"                    with N frames in flight (default 3)\n"
+			"  --no-software     windowed mode: skip the OpenCV software frames, GL (and\n"
+			"                    --readback) only\n"
+			"  --pipeline-depth N  frames queued between render, raster and display stages (default 2)\n"
+			"  --queue-policy P  drop or block when the next stage is busy\n"
+			"                    (default: drop, block while recording)\n"
+			"  --record TARGET   stream frames to a video: - (Y4M on stdout), NAME.y4m,\n"
+			"                    NAME.bgr (raw bgr24) or a file for cv::VideoWriter;\n"
+			"                    records GL readback frames with --readback, software frames otherwise\n"
+			"  --record-fps F    frame rate written to the video (default 60)\n"
+			"  --timings FILE    write p50/p95/p99/max of every frame stage to a CSV file\n"
+			"  --timings-every N  dump and reset the timings every N frames (default: on exit)\n",
+			argv0);
+}
 
-		for (int i = 0; i < vertices.size(); ++i){
-			colors.push_back(color);
+bool parse_options(int argc, char * argv[], Options & opts)
+{
+	for (int i = 1; i < argc; ++i){
+		const char * arg = argv[i];
+		const bool has_value = i + 1 < argc;
+
+		if (strcmp(arg, "--headless") == 0){
+			opts.headless = true;
+		} else if (strcmp(arg, "--frames") == 0 and has_value){
+			opts.frames = atoi(argv[++i]);
+		} else if (strcmp(arg, "--size") == 0 and has_value){
+			if (sscanf(argv[++i], "%dx%d", &opts.width, &opts.height) != 2)
+				return false;
+		} else if (strcmp(arg, "--output") == 0 and has_value){
+			opts.output_dir = argv[++i];
+		} else if (strcmp(arg, "--time-step") == 0 and has_value){
+			opts.time_step = atof(argv[++i]);
+		} else if (strcmp(arg, "--time-scale") == 0 and has_value){
+			opts.time_scale = atof(argv[++i]);
+		} else if (strcmp(arg, "--fleet") == 0 and has_value){
+			opts.fleet = atoi(argv[++i]);
+		} else if (strcmp(arg, "--grid-extent") == 0 and has_value){
+			opts.grid_extent = atof(argv[++i]);
+		} else if (strcmp(arg, "--grid-spacing") == 0 and has_value){
+			opts.grid_spacing = atof(argv[++i]);
+		} else if (strcmp(arg, "--grid-shader") == 0){
+			opts.grid_shader = true;
+		} else if (strcmp(arg, "--fill-ships") == 0){
+			opts.fill_ships = true;
+		} else if (strcmp(arg, "--shader-cache") == 0 and has_value){
+			opts.shader_cache = argv[++i];
+		} else if (strcmp(arg, "--threads") == 0 and has_value){
+			opts.threads = atoi(argv[++i]);
+		} else if (strcmp(arg, "--pin-threads") == 0){
+			opts.pin_threads = true;
+		} else if (strcmp(arg, "--pipeline-depth") == 0 and has_value){
+			opts.pipeline_depth = atoi(argv[++i]);
+		} else if (strcmp(arg, "--queue-policy") == 0 and has_value){
+			const char * policy = argv[++i];
+			if (strcmp(policy, "drop") == 0)
+				opts.queue_policy = QueuePolicy::DROP;
+			else if (strcmp(policy, "block") == 0)
+				opts.queue_policy = QueuePolicy::BLOCK;
+			else
+				return false;
+			opts.queue_policy_given = true;
+		} else if (strcmp(arg, "--record") == 0 and has_value){
+			opts.record = argv[++i];
+		} else if (strcmp(arg, "--timings") == 0 and has_value){
+			opts.timings = argv[++i];
+		} else if (strcmp(arg, "--timings-every") == 0 and has_value){
+			opts.timings_every = atoi(argv[++i]);
+		} else if (strcmp(arg, "--record-fps") == 0 and has_value){
+			opts.record_fps = atof(argv[++i]);
+		} else if (strcmp(arg, "--readback") == 0){
+			opts.readback = true;
+			if (has_value and argv[i + 1][0] != '-')
+				opts.readback_frames = atoi(argv[++i]);
+		} else if (strcmp(arg, "--no-software") == 0){
+			opts.software = false;
+		} else {
+			return false;
 		}
+	}
 
-		glGenBuffers(1, &colorbuffer);
-		glBindBuffer(GL_ARRAY_BUFFER, colorbuffer);
-		glBufferData(GL_ARRAY_BUFFER, colors.size() * sizeof(glm::vec3), glm::value_ptr(colors[0]), GL_STATIC_DRAW);
-
-		glGenVertexArrays(1, &vao);
-		glBindVertexArray(vao);
-
-		glGenBuffers(1, &vbo);
-		glBindBuffer(GL_ARRAY_BUFFER, vbo);
-
-		// Take care of the changed type when you create and initialize the data store of the buffer:
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), glm::value_ptr(vertices[0]), GL_STATIC_DRAW);
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+	if (opts.time_step > 0 and opts.time_scale > 0)
+		return false;
 
-		glGenBuffers(1, &ibo);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(glm::uvec4), glm::value_ptr(indices[0]), GL_STATIC_DRAW);
+	// headless mode has the software frames only, and a recording needs frames
+	if (not opts.software and (opts.headless or (opts.record and not opts.readback)))
+		return false;
 
-		glBindVertexArray(0);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	// a recording must not lose frames
+	if (opts.record and not opts.queue_policy_given)
+		opts.queue_policy = QueuePolicy::BLOCK;
 
-		// Finally calculate the proper number of indices
-		lenght = (GLuint)indices.size() * 4;
-	}
+	return opts.frames >= 0 and opts.width > 0 and opts.height > 0
+			and opts.time_step >= 0 and opts.time_scale >= 0 and opts.fleet >= 0 and opts.threads >= 0 and opts.readback_frames > 0
+			and opts.pipeline_depth > 0 and opts.record_fps > 0
+			and opts.timings_every >= 0 and opts.grid_extent > 0 and opts.grid_spacing > 0;
+}
 
-	glm::mat4 calc_MVP(const glm::mat4 & ViewMatrix, const glm::mat4 & ProjectionMatrix)
-	{
-		double scale_factor = 10;
+std::vector<std::unique_ptr<Drawable>> make_scene(const Options & opts, bool with_gl, ThreadPool * pool)
+{
+	std::vector<std::unique_ptr<Drawable>> objects;
+	objects.emplace_back(new Grid(with_gl, float(opts.grid_extent), float(opts.grid_spacing), opts.grid_shader));
+	objects.emplace_back(new Ship(glm::vec3{1, 0, 0}, 0, with_gl, opts.fill_ships));
+	objects.emplace_back(new Ship(glm::vec3{1, 1, 0}, M_PI / 4, with_gl, opts.fill_ships));
 
-//			First let's store our scale in a 3d vector:
-		glm::vec3 scale = glm::vec3(scale_factor, scale_factor, scale_factor);
+	if (opts.fleet > 0)
+		objects.emplace_back(new Fleet(opts.fleet, with_gl, pool, opts.fill_ships));
 
-//			Now we need a basic model matrix with no transformations:
-		glm::mat4 ModelMatrix = glm::mat4(1.0);
+	return objects;
+}
 
-		glm::mat4 TranslationMatrix = translate(mat4(), glm::vec3(-5.f, 0.0f, -5.f));
+void print_pool(const ThreadPool & pool)
+{
+	if (pool.pinned() > 0)
+		printf("threads: %u, %u workers pinned to cores\n", pool.size(), pool.pinned());
+	else
+		printf("threads: %u\n", pool.size());
+}
 
-		ModelMatrix = TranslationMatrix * ModelMatrix;
+// Scene objects culled as a whole, then flyers culled inside instanced objects
+void print_cull_stats(const std::vector<std::unique_ptr<Drawable>> & objects, const CullStats & object_stats)
+{
+	object_stats.print("culling: objects");
 
-//		Now we can apply the scale to our model matrix:
-		ModelMatrix = glm::scale(ModelMatrix, scale);
+	CullStats instances;
+	for (auto & op : objects)
+		op->add_cull_stats(instances);
+	if (instances.visible + instances.culled > 0)
+		instances.print("culling: instances");
+}
 
-		return ProjectionMatrix * ViewMatrix * ModelMatrix;
+// Prints what the ray hits first and, for a flyer of the fleet, how crowded its neighbourhood is
+void report_pick(const std::vector<std::unique_ptr<Drawable>> & objects, const Ray & ray)
+{
+	size_t object, instance;
+	float t;
+	if (not pick_drawable(objects, ray, object, instance, t)){
+		printf("pick: nothing\n");
+		return;
 	}
 
-	void draw(const glm::mat4 & ViewMatrix, const glm::mat4 & ProjectionMatrix) override
-	{
-		glUseProgram(programID);
-//
-		// Compute the MVP matrix from keyboard and mouse input
-		auto MVP = calc_MVP(ViewMatrix, ProjectionMatrix);
-
-		//		// Send our transformation to the currently bound shader,
-		//		// in the "MVP" uniform
-		glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
-//
-//		// render the grid:
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-		glEnable(GL_DEPTH_TEST);
-		glBindVertexArray(vao);
-
-		// 2nd attribute buffer : colors
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, colorbuffer);
-		glVertexAttribPointer(
-				1,                                // attribute. No particular reason for 1, but must match the layout in the shader.
-				3,                                // size
-				GL_FLOAT,                         // type
-				GL_FALSE,                         // normalized?
-				0,                                // stride
-				(void*)0                          // array buffer offset
-		);
-
-		glDrawElements(GL_LINES, lenght, GL_UNSIGNED_INT, NULL);
-		glBindVertexArray(0);
-		glDisable(GL_DEPTH_TEST);
+	const Fleet * fleet = dynamic_cast<const Fleet *>(objects[object].get());
+	if (not fleet){
+		printf("pick: %s at %.2f\n", objects[object]->name(), t);
+		return;
 	}
 
-	void fix_border_line(cv::Point2d & p1, cv::Point2d & p2, const cv::Size size){
-		// (y - y1) / (y2 - y1) = (x - x1) / (x2 - x1)
-		// y - y1 = (x - x1) * (y2 - y1) / (x2 - x1)
-		// y = (x - x1) * (y2 - y1) / (x2 - x1) + y1
-		// x = (y - y1) * (x2 - x1) / (y2 - y1) + x1
-
-		double x1 = p1.x;
-		double y1 = p1.y;
-		double x2 = p2.x;
-		double y2 = p2.y;
-
-		auto fix = [](double & x, double & y, double x1, double y1, double x2, double y2, double upper_limit){
-			if (x < 0){
-				x = 0;
-				y = (x - x1) * (y2 - y1) / (x2 - x1) + y1;
-			} else if (x > upper_limit){
-				x = upper_limit;
-				y = (x - x1) * (y2 - y1) / (x2 - x1) + y1;
-			}
-		};
-
-		fix(p1.x, p1.y, x1, y1, x2, y2, size.width);
-		fix(p1.y, p1.x, y1, x1, y2, x2, size.height);
-
-		fix(p2.x, p2.y, x2, y2, x1, y1, size.width);
-		fix(p2.y, p2.x, y2, x2, y1, x1, size.height);
+	const float neighbourhood = 2.f;
+	std::vector<unsigned> neighbours;
+	fleet->query_radius(fleet->position(instance), neighbourhood, neighbours);
+	printf("pick: %s #%zu at %.2f, %zu flyers within %.1f\n",
+			fleet->name(), instance, t, neighbours.size() - 1, neighbourhood);
+}
 
-	}
+// Stage timers of the frame loop and their CSV dump (--timings).
+// Every accessor is a no-op when timings are off.
+class TimingReport
+{
+	std::unique_ptr<StageTimers> stage_timers;
+	FILE * file = nullptr;
+	int every = 0;
 
-	void draw(const glm::mat4 & ViewMatrix, const glm::mat4 & ProjectionMatrix, cv::Mat & frame) override
+public:
+	// false if the CSV file cannot be created
+	bool open(const Options & opts)
 	{
-		const glm::mat4 MVP = calc_MVP(ViewMatrix, ProjectionMatrix);
-
-		const cv::Size size = frame.size();
-		const int frame_w = size.width;
-		const int frame_h = size.height;
-
-		std::vector<cv::Point2d> points;
-		std::vector<bool> visible;
-
-		for (const glm::vec3 & v3 : vertices){
-			glm::vec4 v4 = {v3.x, v3.y, v3.z, 1};
-			v4 = MVP * v4;
-			cv::Point2d p;
-
-			p.x = v4.x / v4.w * frame_w / 2 + frame_w / 2;
-			p.y = frame_h - (v4.y / v4.w * frame_h / 2 + frame_h / 2);
-
-			visible.push_back(v4.w > 0);
-			points.push_back(p);
-		}
-
-		const cv::Scalar clr{
-			255 * color[2],
-			255 * color[1],
-			255 * color[0]
-		};
-
-		const cv::Rect2d win_rect({0, 0}, cv::Point(size));
-
-		for (int i = 0; i < indices.size(); i += 1){
-			for (int j = 0; j < 3; ++j){
-				int indx1 = indices[i][j];
-				int indx2 = indices[i][(j + 1) % 4];
-
-				if (!visible[indx1] and !visible[indx2])
-					continue;
-
-				cv::Point2d p1 = points[indx1];
-				cv::Point2d p2 = points[indx2];
+		if (not opts.timings)
+			return true;
 
-				if (visible[indx1] and visible[indx2])
-				{
-					cv::line(frame, p1, p2, clr, 2, 1);
-				} else if (visible[indx1]){
-//					cv::line(frame, p1, p2, clr, 2, 1);
-				} else if (visible[indx2]){
-//					cv::line(frame, p1, p2, clr, 2, 1);
-				}
-			}
+		file = fopen(opts.timings, "w");
+		if (file == nullptr){
+			fprintf(stderr, "Impossible to create %s\n", opts.timings);
+			return false;
 		}
 
-		for (int i = 0; i < points.size(); ++i){
-			const auto & p = points[i];
-			if (visible[i])
-				if (win_rect.contains(p))
-					cv::circle(frame, p, 2, {255, 0, 0}, 2, 1);
-		}
+		StageTimers::write_csv_header(file);
+		stage_timers.reset(new StageTimers());
+		every = opts.timings_every;
+		return true;
 	}
 
-	virtual ~Grid()
+	StageTimers * timers() { return stage_timers.get(); }
+
+	int stage(const std::string & name)
 	{
-		glDeleteBuffers(1, &vbo);
-		glDeleteBuffers(1, &ibo);
-		glDeleteVertexArrays(1, &vao);
-		glDeleteProgram(programID);
+		return stage_timers ? stage_timers->stage(name) : -1;
 	}
-};
-
-class Ship : public Drawable
-{
-	GLuint vao;
-	GLuint vertexbuffer;
-
-	GLuint programID;
-	GLuint MatrixID;
-
-	const double delta_theta;
-
-	GLuint colorbuffer;
-	const glm::vec3 color;
-
-	// 4 triangles
-	// 5 unique vertices
-	// 4 * 3 indices
-	const std::vector<glm::vec3> vertices = {
-			{0.f, 0.f, 1.f},
-			{-1.f, 0.f, -1.f},
-			{1.f, 0.f, -1.f},
-
-			{0.f, 0.f, 1.f},
-			{-1.f, 1.f, -1.f},
-			{1.f, 1.f, -1.f},
-
-			{0.f, 0.f, 1.f},
-			{-1.f, 0.f, -1.f},
-			{-1.f, 1.f, -1.f},
 
-			{0.f, 0.f, 1.f},
-			{1.f, 0.f, -1.f},
-			{1.f, 1.f, -1.f},
-	};
-
-public:
-
-	Ship(glm::vec3 color_, double delta_theta_) : color(color_), delta_theta(delta_theta_)
+	// One stage per object, named prefix:Grid, prefix:Ship...
+	std::vector<int> drawable_stages(const std::vector<std::unique_ptr<Drawable>> & objects, const char * prefix)
 	{
-		programID = LoadShaders(
-			"TransformVertexShader.vertexshader",
-			"ColorFragmentShader.fragmentshader"
-		);
-
-		// Get a handle for our "MVP" uniform
-		MatrixID = glGetUniformLocation(programID, "MVP");
-
-		glGenVertexArrays(1, &vao);
-		glBindVertexArray(vao);
-
-		const GLfloat g_color_buffer_data[] = {
-				color[0], color[1], color[2],
-				color[0], color[1], color[2],
-				color[0], color[1], color[2],
-
-				color[0], color[1], color[2],
-				color[0], color[1], color[2],
-				color[0], color[1], color[2],
-
-				color[0], color[1], color[2],
-				color[0], color[1], color[2],
-				color[0], color[1], color[2],
-
-				color[0], color[1], color[2],
-				color[0], color[1], color[2],
-				color[0], color[1], color[2],
-		};
-
-// This will identify our vertex buffer
-//		GLuint vertexbuffer;
-// Generate 1 buffer, put the resulting identifier in vertexbuffer
-		glGenBuffers(1, &vertexbuffer);
-// The following commands will talk about our 'vertexbuffer' buffer
-		glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-// Give our vertices to OpenGL.
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), glm::value_ptr(vertices[0]), GL_STATIC_DRAW);
-		// Finally calculate the proper number of indices
-
-		glGenBuffers(1, &colorbuffer);
-		glBindBuffer(GL_ARRAY_BUFFER, colorbuffer);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(g_color_buffer_data), g_color_buffer_data, GL_STATIC_DRAW);
-
-		glBindVertexArray(0);
+		std::vector<int> ids;
+		for (auto & op : objects)
+			ids.push_back(stage(std::string(prefix) + ":" + op->name()));
+		return ids;
 	}
 
-	glm::vec3 calc_position(std::chrono::system_clock::time_point tp)
+	void end_frame(unsigned long frame)
 	{
-		double t = std::chrono::duration_cast<std::chrono::milliseconds>(tp.time_since_epoch()).count();
-		t = t / 1000;
-
-		double r = 5; // radius
-		double T = 10; // period
-		double theta = 2 * M_PI * t / T + delta_theta;// angle
-
-		double x = r * cos(theta);
-//		double y = r * sin(theta) / 3;
-		double y = 0;
-		double z = r * sin(theta);
-
-
-		// rotate around X
-//		double alpha = M_PI_4 / 2;
-		double alpha = M_PI_4;
-
-		glm::mat3 rotation = {
-				{1, 0, 0},
-				{0, cos(alpha), -sin(alpha)},
-				{0, sin(alpha), cos(alpha)},
-		};
-
-		return rotation * glm::vec3{x, y, z};
+		if (file and every > 0 and frame % every == 0)
+			stage_timers->write_csv(file, frame);
 	}
 
+	void finish(unsigned long frame)
+	{
+		if (not file)
+			return;
 
-	glm::vec3 prev_pos = calc_position(std::chrono::system_clock::now());
-
-	double calc_angle(const glm::vec3 & r1, const glm::vec3 & r2){
-		return acos(glm::dot(glm::normalize(r1), glm::normalize(r2)));
+		stage_timers->write_csv(file, frame);
+		fclose(file);
+		file = nullptr;
 	}
 
-	glm::vec3 calc_axis(const glm::vec3 & r1, const glm::vec3 & r2){
-		return glm::cross(r1, r2);
+	~TimingReport()
+	{
+		if (file)
+			fclose(file);
 	}
+};
 
-	glm::mat4 calcMVP(const glm::mat4 & ViewMatrix, const glm::mat4 & ProjectionMatrix){
-		//		double scale_factor = 0.01;
-		double scale_factor = 0.5;
-
-		glm::vec3 curr_pos = calc_position(std::chrono::system_clock::now());
-
-//			Now we need a basic model matrix with no transformations:
-		glm::mat4 ModelMatrix = glm::mat4(1.0);
-
-		// scale model
-//			First let's store our scale in a 3d vector:
-		glm::vec3 scale = glm::vec3(scale_factor, scale_factor, scale_factor);
-//			Now we can apply the scale to our model matrix:
-		ModelMatrix = glm::scale(ModelMatrix, scale);
-
-		// rotate model
-		glm::vec3 n = glm::normalize(curr_pos - prev_pos);
-		prev_pos = curr_pos;
-
-		glm::vec3 n_xz = glm::vec3{n.x, 0, n.z};
+// Drives every Drawable through its software path only: no window, no GL context.
+// Frames are written to opts.output_dir when given, otherwise discarded.
+int run_headless(const Options & opts)
+{
+	ThreadPool pool(opts.threads, opts.pin_threads);
+	print_pool(pool);
+	std::vector<std::unique_ptr<Drawable>> objects = make_scene(opts, false, &pool);
+
+	const glm::mat4 ViewMatrix = glm::lookAt(
+			glm::vec3(5, 10, -10),
+			glm::vec3(0, 0, 0),
+			glm::vec3(0, 1, 0)
+	);
 
-		ModelMatrix = glm::rotate(ModelMatrix, float(calc_angle(n_xz, n)), calc_axis(n_xz, n)); // where x, y, z is axis of rotation (e.g. 0 1 0)
-		ModelMatrix = glm::rotate(ModelMatrix, float(calc_angle({0, 0, 1}, n_xz)), calc_axis({0, 0, 1}, n_xz)); // where x, y, z is axis of rotation (e.g. 0 1 0)
+	const glm::mat4 ProjectionMatrix = glm::perspective(
+			glm::radians(45.f),
+			(GLfloat)opts.width / (GLfloat)opts.height,
+			1.0f,
+			150.0f
+	);
 
-		// translate model
-		glm::mat4 TranslationMatrix = translate(mat4(), curr_pos);
+	SimClock clock = SimClock::fixed_step(opts.time_step > 0 ? opts.time_step : 1.0 / 60);
+	if (opts.time_scale > 0)
+		clock = SimClock::scaled(opts.time_scale);
 
-		ModelMatrix = TranslationMatrix * ModelMatrix;
+	TileRasterizer raster(&pool);
+	StaticLayer static_layer(&pool);
+	FramePool frames(cv::Size(opts.width, opts.height), CV_8UC3, 1);
 
-		glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
-		//		// Send our transformation to the currently bound shader,
-		//		// in the "MVP" uniform
-		return MVP;
+	std::unique_ptr<VideoOutput> video;
+	if (opts.record){
+		video = VideoOutput::open(opts.record, frames.frame_size(), opts.record_fps);
+		if (not video)
+			return -1;
 	}
 
+	TimingReport timing;
+	if (not timing.open(opts))
+		return -1;
 
+	StageTimers * timers = timing.timers();
+	const int frame_stage = timing.stage("frame");
+	const int update_stage = timing.stage("update");
+	const int cull_stage = timing.stage("cull");
+	const int static_stage = timing.stage("static layer");
+	const int raster_stage = timing.stage("raster");
+	const int output_stage = timing.stage("output");
+	const std::vector<int> record_stages = timing.drawable_stages(objects, "record");
 
-	void draw(const glm::mat4 & ViewMatrix, const glm::mat4 & ProjectionMatrix) override
-	{
-		// Use our shader
-		glUseProgram(programID);
-
-		// Compute the MVP matrix from keyboard and mouse input
-
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-//		glDisable(GL_DEPTH_TEST);
-//		glDisable(GL_DEPTH_TEST);
-		glEnable(GL_DEPTH_TEST);
-
-		glBindVertexArray(vao);
-
-		glm::mat4 MVP = calcMVP(ViewMatrix, ProjectionMatrix);
-		//		// Send our transformation to the currently bound shader,
-		//		// in the "MVP" uniform
-
-		glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		// 1rst attribute buffer : vertices
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-		glVertexAttribPointer(
-				0,                  // attribute. No particular reason for 0, but must match the layout in the shader.
-				3,                  // size
-				GL_FLOAT,           // type
-				GL_FALSE,           // normalized?
-				0,                  // stride
-				(void*)0            // array buffer offset
-		);
-
-		// 2nd attribute buffer : colors
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, colorbuffer);
-		glVertexAttribPointer(
-				1,                                // attribute. No particular reason for 1, but must match the layout in the shader.
-				3,                                // size
-				GL_FLOAT,                         // type
-				GL_FALSE,                         // normalized?
-				0,                                // stride
-				(void*)0                          // array buffer offset
-		);
-
-		// Draw the triangle !
-		glDrawArrays(GL_TRIANGLES, 0, 4 * 3 * 3); // 12*3 indices starting at 0 -> 12 triangles
-
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-	}
-
-	void draw(const glm::mat4 & ViewMatrix, const glm::mat4 & ProjectionMatrix, cv::Mat & frame) override
-	{
-		glm::mat4 MVP = calcMVP(ViewMatrix, ProjectionMatrix);
-
-		cv::Size size = frame.size();
-		int frame_w = size.width;
-		int frame_h = size.height;
+	std::vector<unsigned char> visible;
+	CullStats cull_stats;
 
-		std::vector<cv::Point> points;
-		std::vector<bool> visible;
+	std::string path;
+	char file_name[32];
 
+	const auto start = std::chrono::steady_clock::now();
+	auto report = start;
+	int report_frames = 0;
 
-		for (const glm::vec3 & v3 : vertices){
-			glm::vec4 v4 = {v3.x, v3.y, v3.z, 1};
-			v4 = MVP * v4;
+	int frame = 0;
+	for (; opts.frames == 0 or frame < opts.frames; ++frame){
+		ScopedStageTimer frame_timer(timers, frame_stage);
 
-			cv::Point2i p;
-			p.x = v4.x / v4.w * frame_w / 2 + frame_w / 2;
-			p.y = frame_h - (v4.y / v4.w * frame_h / 2 + frame_h / 2);
-			points.push_back(p);
-			visible.push_back(v4.w > 0);
+		{
+			ScopedStageTimer timer(timers, update_stage);
+			clock.tick();
+			for (auto & op : objects)
+				op->update(clock);
 		}
 
-		cv::Scalar clr{
-			255 * color[2],
-			255 * color[1],
-			255 * color[0]}
-			;
-
-		const cv::Rect2d win_rect({0, 0}, cv::Point(size));
+		{
+			ScopedStageTimer timer(timers, cull_stage);
+			cull_drawables(objects, ViewMatrix, ProjectionMatrix, visible, cull_stats);
+		}
 
-		for (int i = 0; i < points.size(); i += 3){
-			for (int j = 0; j < 3; ++j){
-				int idx1 = i + j;
-				int idx2 = i + (j + 1) % 3;
+		FramePool::Frame frame_buffer = frames.acquire();
+		cv::Mat & image = frame_buffer.mat;
 
-				if (!visible[idx1] or !visible[idx2])
+		// static objects are only redrawn when the view changes
+		if (static_layer.stale(ViewMatrix, ProjectionMatrix, image.size(), cv::Scalar(20, 0, 0))){
+			for (size_t i = 0; i < objects.size(); ++i){
+				if (not visible[i] or not objects[i]->is_static())
 					continue;
-
-				auto p1 = points[idx1];
-				auto p2 = points[idx2];
-
-				cv::line(frame, p1, p2, clr,2, 1);
+				ScopedStageTimer timer(timers, record_stages[i]);
+				objects[i]->draw(ViewMatrix, ProjectionMatrix, static_layer.raster());
 			}
+			ScopedStageTimer timer(timers, static_stage);
+			static_layer.rebuild();
 		}
 
-		for (int i = 0; i < points.size(); ++i){
-			if (visible[i])
-				cv::circle(frame, points[i], 2, {255, 0, 0}, 2, 1);
+		raster.begin_frame(image.size());
+		for (size_t i = 0; i < objects.size(); ++i){
+			if (not visible[i] or objects[i]->is_static())
+				continue;
+			ScopedStageTimer timer(timers, record_stages[i]);
+			objects[i]->draw(ViewMatrix, ProjectionMatrix, raster);
 		}
-	}
 
+		{
+			ScopedStageTimer timer(timers, raster_stage);
+			static_layer.image()->copyTo(image);
+			raster.rasterize(image);
+		}
 
-	virtual ~Ship()
-	{
-		glDeleteBuffers(1, &vertexbuffer);
-		glDeleteVertexArrays(1, &vao);
-		glDeleteProgram(programID);
-	}
-};
+		ScopedStageTimer output_timer(timers, output_stage);
 
+		if (video)
+			video->write(image);
 
-mat4 LookAtRH(vec3 eye, vec3 target, vec3 up )
-{
-	vec3 zaxis = glm::normalize(eye - target);    // The "forward" vector.
-	vec3 xaxis = glm::normalize(glm::cross(up, zaxis));// The "right" vector.
-	vec3 yaxis = glm::cross(zaxis, xaxis);     // The "up" vector.
+		if (opts.output_dir){
+			snprintf(file_name, sizeof(file_name), "/frame_%06d.png", frame);
+			path = opts.output_dir;
+			path += file_name;
+			if (not cv::imwrite(path, image)){
+				fprintf(stderr, "Failed to write %s\n", path.c_str());
+				return -1;
+			}
+		}
 
-	// Create a 4x4 orientation matrix from the right, up, and forward vectors
-	// This is transposed which is equivalent to performing an inverse
-	// if the matrix is orthonormalized (in this case, it is).
-	mat4 orientation = {
-			vec4( xaxis.x, yaxis.x, zaxis.x, 0 ),
-			vec4( xaxis.y, yaxis.y, zaxis.y, 0 ),
-			vec4( xaxis.z, yaxis.z, zaxis.z, 0 ),
-			vec4(   0,       0,       0,     1 )
-	};
+		++report_frames;
+		const auto now = std::chrono::steady_clock::now();
+		const double since_report = std::chrono::duration<double>(now - report).count();
+		if (since_report >= 1.0){
+			printf("headless: frame %d, %.1f fps\n", frame + 1, report_frames / since_report);
+			report = now;
+			report_frames = 0;
+		}
 
-	// Create a 4x4 translation matrix.
-	// The eye position is negated which is equivalent
-	// to the inverse of the translation matrix.
-	// T(v)^-1 == T(-v)
-	mat4 translation = {
-			vec4(   1,      0,      0,   0 ),
-			vec4(   0,      1,      0,   0 ),
-			vec4(   0,      0,      1,   0 ),
-			vec4(-eye.x, -eye.y, -eye.z, 1 )
-	};
+		// close the frame's samples before a dump, so they count in this interval
+		output_timer.stop();
+		frame_timer.stop();
+		timing.end_frame(frame + 1);
+	}
 
-	// Combine the orientation and translation to compute
-	// the final view matrix. Note that the order of
-	// multiplication is reversed because the matrices
-	// are already inverted.
-	return orientation * translation;
+	timing.finish(frame);
+
+	const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("headless: %d frames %dx%d in %.3f s, %.1f fps\n",
+			opts.frames, opts.width, opts.height, elapsed, elapsed > 0 ? opts.frames / elapsed : 0.0);
+	print_cull_stats(objects, cull_stats);
+	printf("threads: %zu tasks stolen\n", pool.steals());
+	static_layer.print_stats("static layer");
+	frames.print_stats("frame pool");
+	if (video){
+		video->finish();
+		video->print_stats("video");
+	}
+
+	return 0;
 }
 
 
-int main(void)
+int main(int argc, char * argv[])
 {
+	Options opts;
+	if (not parse_options(argc, argv, opts)){
+		print_usage(argv[0]);
+		return -1;
+	}
+
+	if (opts.headless)
+		return run_headless(opts);
+
 	// Initialise GLFW
 	if( !glfwInit() )
 	{
@@ -633,8 +553,8 @@ int main(void)
 
 	// Open a window and create its OpenGL context
 
-	int win_width = 1024;
-	int win_height = 768;
+	int win_width = opts.width;
+	int win_height = opts.height;
 
 	window = glfwCreateWindow( win_width, win_height, "OpenGL", nullptr, nullptr);
 	if(window == nullptr){
@@ -654,6 +574,9 @@ int main(void)
 		return -1;
 	}
 
+	if (opts.shader_cache)
+		SetShaderCacheDirectory(opts.shader_cache);
+
 	// Ensure we can capture the escape key being pressed below
 	glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
 	// Hide the mouse and enable unlimited mouvement
@@ -661,20 +584,19 @@ int main(void)
 
 	// Set the mouse at the center of the screen
 	glfwPollEvents();
-	glfwSetCursorPos(window, 1024 / 2, 768 / 2);
+	glfwSetCursorPos(window, win_width / 2, win_height / 2);
 
 	// Dark blue background
 	glClearColor(0.0f, 0.0f, 0.4f, 0.0f);
 
 	// Enable depth test
-	glEnable(GL_DEPTH_TEST);
+	gl_state().enable(GL_DEPTH_TEST);
 	// Accept fragment if it closer to the camera than the former one
 	glDepthFunc(GL_LESS);
 
-	std::vector<std::unique_ptr<Drawable>> objects;
-	objects.emplace_back(new Grid());
-	objects.emplace_back(new Ship(glm::vec3{1, 0, 0}, 0));
-	objects.emplace_back(new Ship(glm::vec3{1, 1, 0}, M_PI / 4));
+	ThreadPool pool(opts.threads, opts.pin_threads);
+	print_pool(pool);
+	std::vector<std::unique_ptr<Drawable>> objects = make_scene(opts, true, &pool);
 
 	glm::vec3 cameraPosition = glm::vec3(5,10,-10);
 	glm::vec3 cameraTarget = glm::vec3(0,0,0);
@@ -695,58 +617,223 @@ int main(void)
 			150.0f // Far clipping plane. Keep as little as possible.
 	);
 
-	bool export_to_opencv = false;
+	bool export_to_opencv = opts.readback;
 //	bool fixed_camera = true;
 	bool fixed_camera = false;
 
+	// a frame per slot of the raster and display queues, plus one being worked on by each stage
+	FramePool frames(cv::Size(win_width, win_height), CV_8UC3, 2 * opts.pipeline_depth + 2);
+	// grid and other static objects, rasterized again only when the camera moves
+	StaticLayer static_layer(&pool);
+
+	std::unique_ptr<VideoOutput> video;
+	const RenderPipeline::Channel recorded_channel = opts.readback ? RenderPipeline::READBACK : RenderPipeline::SOFTWARE;
+	if (opts.record){
+		video = VideoOutput::open(opts.record, frames.frame_size(), opts.record_fps);
+		if (not video){
+			objects.clear();
+			glfwTerminate();
+			return -1;
+		}
+	}
+
+	TimingReport timing;
+	if (not timing.open(opts)){
+		objects.clear();
+		glfwTerminate();
+		return -1;
+	}
+
+	StageTimers * timers = timing.timers();
+	const int frame_stage = timing.stage("frame");
+	const int update_stage = timing.stage("update");
+	const int controls_stage = timing.stage("controls");
+	const int cull_stage = timing.stage("cull");
+	const int uniforms_stage = timing.stage("uniforms");
+	const int static_stage = timing.stage("static layer");
+	const int execute_stage = timing.stage("execute");
+	const int swap_stage = timing.stage("swap");
+	const int readback_stage = timing.stage("readback");
+	const std::vector<int> draw_stages = timing.drawable_stages(objects, "draw");
+	const std::vector<int> record_stages = timing.drawable_stages(objects, "record");
+
+	// OpenCV display runs on its own thread, so imshow and waitKey never hold up rendering
+	RenderPipeline pipeline(frames, &pool, opts.pipeline_depth, opts.queue_policy,
+			[&video, recorded_channel](const cv::Mat & frame, RenderPipeline::Channel channel){
+				if (video and channel == recorded_channel)
+					video->write(frame);
+
+				cv::imshow(channel == RenderPipeline::SOFTWARE ? "OpenCV" : "OpenGL readback", frame);
+				cv::waitKey(1);
+			},
+			timers);
+
+	std::unique_ptr<GpuReadback> readback;
+	if (export_to_opencv)
+		readback.reset(new GpuReadback(win_width, win_height, opts.readback_frames));
+
+	// camera and model matrices of all GL draws, one buffer region per frame in flight
+	std::unique_ptr<FrameUniforms> uniforms(new FrameUniforms());
+	// draw packets of every object, sorted by GL state before they are issued
+	RenderQueue render_queue;
+
+	// Flips a finished readback into a pooled frame and passes it to the display stage
+	auto show_readback = [&](bool wait){
+		ScopedStageTimer timer(timers, readback_stage);
+
+		cv::Mat view;
+		if (not readback->map_oldest(view, wait))
+			return;
+
+		FramePool::Frame frame = frames.acquire();
+		GpuReadback::copy_flipped(view, frame.mat);
+		readback->unmap_oldest();
+
+		pipeline.present(std::move(frame));
+	};
+
+	SimClock clock = SimClock::wall_clock();
+	if (opts.time_step > 0)
+		clock = SimClock::fixed_step(opts.time_step);
+	else if (opts.time_scale > 0)
+		clock = SimClock::scaled(opts.time_scale);
+
+	unsigned long frame_count = 0;
+
+	std::vector<unsigned char> visible;
+	CullStats cull_stats;
+	bool was_clicked = false;
+
 	do{
+		ScopedStageTimer frame_timer(timers, frame_stage);
+
+		{
+			ScopedStageTimer timer(timers, update_stage);
+			clock.tick();
+			for (auto & op : objects)
+				op->update(clock);
+		}
+
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		if (not fixed_camera){
+			ScopedStageTimer timer(timers, controls_stage);
 			computeMatricesFromInputs();
 			ViewMatrix = getViewMatrix();
 			ProjectionMatrix = getProjectionMatrix();
 		}
 
-//		if (PrevViewMatrix == ViewMatrix){
-//			continue;
-//		} else {
-//			PrevViewMatrix = ViewMatrix;
-//		}
-
-		for (auto & op : objects)
-			op->draw(ViewMatrix, ProjectionMatrix);
+		// one cull pass serves the GL draws and the software record below
+		{
+			ScopedStageTimer timer(timers, cull_stage);
+			cull_drawables(objects, ViewMatrix, ProjectionMatrix, visible, cull_stats);
+		}
 
-		// Swap buffers
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		// Left click picks along the view direction: the controls keep the cursor
+		// at the window center, so that is where it points
+		const bool clicked = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+		if (clicked and not was_clicked)
+			report_pick(objects, ray_through_pixel(win_width / 2.0, win_height / 2.0, win_width, win_height, ViewMatrix, ProjectionMatrix));
+		was_clicked = clicked;
+
+		// All transforms of the frame go out in one write before the draws
+		{
+			ScopedStageTimer timer(timers, uniforms_stage);
+			uniforms->begin_frame(ProjectionMatrix * ViewMatrix);
+			for (size_t i = 0; i < objects.size(); ++i)
+				if (visible[i])
+					objects[i]->prepare(*uniforms);
+			uniforms->commit();
+		}
 
-		bool render_in_opencv = true;
-		if (render_in_opencv){
-			cv::Mat image(win_height, win_width, CV_8UC3, {20, 0, 0});
+		// CPU side submission cost; the GPU work itself shows up in swap or readback
+		for (size_t i = 0; i < objects.size(); ++i){
+			if (not visible[i])
+				continue;
+			ScopedStageTimer timer(timers, draw_stages[i]);
+			objects[i]->draw(ViewMatrix, ProjectionMatrix, render_queue);
+		}
+		{
+			ScopedStageTimer timer(timers, execute_stage);
+			render_queue.execute();
+		}
+		uniforms->end_frame();
 
-			for (auto & op : objects)
-				op->draw(ViewMatrix, ProjectionMatrix, image);
+		// Read the back buffer before it is swapped out. Frame K is mapped while
+		// the next frames render; only a full ring makes us wait for the GPU.
+		if (export_to_opencv){
+			if (readback->full())
+				show_readback(true);
+			readback->queue();
+		}
 
-			cv::imshow("OpenCV", image);
-			cv::waitKey(5);
+		// Swap buffers
+		{
+			ScopedStageTimer timer(timers, swap_stage);
+			glfwSwapBuffers(window);
+			glfwPollEvents();
 		}
 
-		if (export_to_opencv){
-			unsigned char* buffer = new unsigned char[win_width * win_height * 3];
-			glReadPixels(0, 0, win_width, win_height, GL_RGB, GL_UNSIGNED_BYTE, buffer);
-
-			cv::Mat image(win_height, win_width, CV_8UC3, buffer);
-			flip(image, image, 0);
-			cvtColor(image, image, CV_RGB2BGR);
-			cv::imshow("OpenCV", image);
-			cv::waitKey(5);
+		// Record the software frame here; rasterization and display happen on the pipeline threads
+		if (opts.software){
+			const cv::Size size(win_width, win_height);
+			const cv::Scalar background(20, 0, 0);
+			TileRasterizer * raster = pipeline.begin_frame(size, background);
+			if (raster){
+				// static objects are only redrawn when the camera moves
+				if (static_layer.stale(ViewMatrix, ProjectionMatrix, size, background)){
+					for (size_t i = 0; i < objects.size(); ++i){
+						if (not visible[i] or not objects[i]->is_static())
+							continue;
+						ScopedStageTimer timer(timers, record_stages[i]);
+						objects[i]->draw(ViewMatrix, ProjectionMatrix, static_layer.raster());
+					}
+					ScopedStageTimer timer(timers, static_stage);
+					static_layer.rebuild();
+				}
+
+				for (size_t i = 0; i < objects.size(); ++i){
+					if (not visible[i] or objects[i]->is_static())
+						continue;
+					ScopedStageTimer timer(timers, record_stages[i]);
+					objects[i]->draw(ViewMatrix, ProjectionMatrix, *raster);
+				}
+				pipeline.submit(raster, static_layer.image());
+			}
 		}
 
+		if (export_to_opencv)
+			show_readback(false);
+
+		frame_timer.stop();
+		timing.end_frame(++frame_count);
+
 	} // Check if the ESC key was pressed or the window was closed
 	while( glfwGetKey(window, GLFW_KEY_ESCAPE ) != GLFW_PRESS &&
 	       glfwWindowShouldClose(window) == 0 );
 
+	// the frames still in flight reach the sink, and the video, before the stats
+	pipeline.finish();
+	timing.finish(frame_count);
+	print_cull_stats(objects, cull_stats);
+	printf("threads: %zu tasks stolen\n", pool.steals());
+	printf("uniforms: %s mapping, %lu frames waited for the GPU\n",
+			uniforms->persistent() ? "persistent" : "per frame", uniforms->waits());
+	render_queue.print_stats("render queue");
+	gl_state().print_stats("gl state", frame_count);
+	pipeline.print_stats("pipeline");
+	static_layer.print_stats("static layer");
+	frames.print_stats("frame pool");
+	if (video){
+		video->finish();
+		video->print_stats("video");
+	}
+
+	// GL objects go before the context
+	readback.reset();
+	uniforms.reset();
+	objects.clear();
+
 	// Close OpenGL window and terminate GLFW
 	glfwTerminate();
 